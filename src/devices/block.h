@@ -53,6 +53,9 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, void *, size_t cnt);
+void block_write_multi (struct block *, block_sector_t, const void *,
+                        size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,6 +68,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT consecutive sectors at once.  If
+       null, the block layer falls back to one call per sector. */
+    void (*read_multi) (void *aux, block_sector_t, void *buffer,
+                        size_t cnt);
+    void (*write_multi) (void *aux, block_sector_t, const void *buffer,
+                         size_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
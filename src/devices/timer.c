@@ -1,17 +1,12 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
-#include <hash.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-#include "vm/page.h"
-#include "userprog/pagedir.h"
-
-#define K 4 // K = TIME_SLICE
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -29,9 +24,59 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
-/* List of all processes that is asleep. Processes are added to this list
-   when timer_sleep is called on them and removed when they wake up. */
-static struct list sleep_list;
+/* If false (default), the timer interrupts TIMER_FREQ times per
+   second.  If true, the periodic interrupt is stopped while the
+   CPU is idle and the PIT is instead programmed to interrupt
+   once, at the next tick at which a timer is due.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick. */
+#define PIT_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks that a single one-shot interrupt may stand for.
+   The PIT's counter has only 16 bits, and we leave some room
+   below 65536 so that a one-shot counter that has run out and
+   wrapped around can be told apart from one that is still
+   counting. */
+#define ONESHOT_MAX_TICKS ((0xffff - PIT_PER_TICK / 4) / PIT_PER_TICK)
+
+/* Number of ticks that the pending one-shot interrupt stands
+   for, or 0 if the timer is interrupting periodically. */
+static unsigned oneshot_ticks;
+
+/* Statistics. */
+static int64_t intr_cnt;        /* # of timer interrupts. */
+static int64_t intr_cnt_second; /* intr_cnt at start of this second. */
+static int64_t intr_min_rate;   /* Fewest interrupts in one second. */
+static int64_t intr_max_rate;   /* Most interrupts in one second. */
+
+/* Timing wheel of pending timers.
+
+   The wheel has WHEEL_LEVELS levels of WHEEL_SIZE slots each.  A
+   timer due DELTA ticks after wheel_ticks is put in the lowest
+   level L with DELTA < WHEEL_SIZE**(L + 1), in the slot chosen by
+   bits WHEEL_BITS*L and up of its expiry time.  Each time the
+   slot index of level L wraps to 0, the current slot of level
+   L + 1 is "cascaded" by adding its timers again, which moves
+   them down to a lower level.  Timers in level 0 fire when the
+   wheel reaches their slot.
+
+   Thus adding and cancelling a timer take constant time, and
+   each timer is cascaded at most WHEEL_LEVELS - 1 times before
+   it fires, no matter how many timers are pending.  Timers due
+   more than WHEEL_SPAN ticks ahead wait in the last slot of the
+   top level and are cascaded back to the top level until they
+   come within range. */
+#define WHEEL_BITS 6                            /* Index bits per level. */
+#define WHEEL_SIZE (1 << WHEEL_BITS)            /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4                          /* Number of levels. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Next tick to be processed by the timing wheel. */
+static int64_t wheel_ticks;
 
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
@@ -39,16 +84,24 @@ static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
-static bool list_less_wake (const struct list_elem *a,
-                            const struct list_elem *b, void *aux UNUSED);
-static inline void wake_ready (void);
+static void wheel_insert (struct timer *);
+static void wheel_cascade (int level);
+static void wheel_advance (void);
+static unsigned wheel_quiet_ticks (unsigned max);
+static bool oneshot_start (bool stopped);
+static timer_func wake_sleeper;
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
-  list_init (&sleep_list);
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -108,35 +161,82 @@ timer_sleep (int64_t ticks)
     {
       int64_t start = timer_ticks ();
       struct thread *t;
-      enum intr_level old_level;
 
       ASSERT (intr_get_level () == INTR_ON);
 
       t = thread_current ();
-      sema_init (&t->can_wake, 0); /* Initialise semaphore to 0. */
-      t->wake_ticks = start + ticks; /* Set up the ticks to wake up at. */
-
-      /* Disabling interrupts while add the thread to sleep_list. */
-      old_level = intr_disable ();
-      list_insert_ordered (&sleep_list, &t->sleepelem, &list_less_wake, NULL);
-      intr_set_level (old_level);
-
-      sema_down (&t->can_wake); /* Down the semaphore. */
-      /* Current thread, on which sleep was called, now goes onto the
-         waiting list of the semaphore, causing its state to change to
-         BLOCKED. This means that a different thread, one that is READY
-         can run, and if no other threads are READY, the idle thread runs. */
+      sema_init (&t->can_wake, 0);
+      timer_setup (&t->sleep_timer, wake_sleeper, t);
+      timer_add (&t->sleep_timer, start + ticks);
+
+      /* Block until wake_sleeper() ups the semaphore. */
+      sema_down (&t->can_wake);
     }
 }
 
-/* Comparison function used to insert threads into sleep_list in
-   ascending order of wake_ticks value. */
-static bool
-list_less_wake (const struct list_elem *a, const struct list_elem *b,
-                void *aux UNUSED)
+/* Timer function for timer_sleep(): wakes thread T_. */
+static void
+wake_sleeper (void *t_)
 {
-  return list_entry (a, struct thread, sleepelem)->wake_ticks
-      < list_entry (b, struct thread, sleepelem)->wake_ticks;
+  struct thread *t = t_;
+
+  sema_up (&t->can_wake);
+}
+
+/* Initializes timer T to call FUNC (AUX) when it fires. */
+void
+timer_setup (struct timer *t, timer_func *func, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+
+  t->func = func;
+  t->aux = aux;
+  t->pending = false;
+}
+
+/* Arranges for timer T, which must not be pending, to fire at
+   the first timer interrupt at which timer_ticks() is at least
+   EXPIRES.  Takes constant time.
+
+   This function may be called from an interrupt handler. */
+void
+timer_add (struct timer *t, int64_t expires)
+{
+  enum intr_level old_level;
+
+  ASSERT (t != NULL);
+  ASSERT (!t->pending);
+
+  old_level = intr_disable ();
+  t->expires = expires;
+  t->pending = true;
+  wheel_insert (t);
+  intr_set_level (old_level);
+}
+
+/* Cancels timer T.  Returns true if T was pending, false if it
+   had already fired or was never added.  Takes constant time.
+
+   This function may be called from an interrupt handler. */
+bool
+timer_cancel (struct timer *t)
+{
+  enum intr_level old_level;
+  bool pending;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  pending = t->pending;
+  if (pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
+  intr_set_level (old_level);
+
+  return pending;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -202,76 +302,219 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the scheduler, with interrupts off, whenever it
+   switches away from the idle thread, including straight from an
+   interrupt that made a thread ready during `hlt'.  If the
+   periodic timer interrupt was stopped while the CPU was idle,
+   arranges for the timer to interrupt at the next tick boundary
+   instead of the planned one.  That interrupt catches up `ticks'
+   and resumes periodic interrupts, so timer_ticks() may lag by
+   less than one tick until then. */
+void
+timer_idle_exit (void)
+{
+  uint16_t counter, next;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0 || thread_is_idle ())
+    return;
+
+  /* COUNTER is the number of PIT cycles left until the planned
+     interrupt.  If it has run out, the interrupt is pending
+     already. */
+  counter = pit_read_counter (0);
+  if (counter == 0 || counter > oneshot_ticks * PIT_PER_TICK)
+    return;
+
+  /* Interrupt at the next tick boundary, standing for all the
+     ticks up to and including it. */
+  next = counter % PIT_PER_TICK;
+  if (next == 0)
+    next = PIT_PER_TICK;
+  if (next != counter)
+    {
+      oneshot_ticks -= (counter - next) / PIT_PER_TICK;
+      pit_start_oneshot (0, next);
+    }
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %"PRId64" interrupts\n",
+          timer_ticks (), intr_cnt);
+  if (intr_max_rate > 0)
+    printf ("Timer: %"PRId64" to %"PRId64" interrupts per second\n",
+            intr_min_rate, intr_max_rate);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-#ifdef USERPROG
-  if (thread_current ()->active_proc) //&& thread_current ()->tid > 2)
+  bool stopped = oneshot_ticks != 0;
+  unsigned elapsed = stopped ? oneshot_ticks : 1;
+
+  intr_cnt++;
+  oneshot_ticks = 0;
+
+  /* All but the last of the ticks caught up by a one-shot
+     interrupt passed while the CPU was idle. */
+  while (elapsed-- > 0)
     {
-      // Every K ticks
-      if (timer_ticks () % K == 0)
+      ticks++;
+      thread_tick (elapsed > 0);
+
+      if (ticks % TIMER_FREQ == 0)
         {
-          struct thread *t = thread_current ();
-          uint32_t *pd = t->pagedir;
-          struct hash_iterator i;
-          hash_first (&i, &t->page_table);
-          while (hash_next (&i))
-            {
-              // If a page was accessed, update it's last_accessed field
-              struct page *p = hash_entry(hash_cur (&i), struct page,
-                                          pagehashelem);
-              if (pagedir_is_accessed (pd, p->uaddr))
-                {
-                  // set last_accessed_time to the current number of timer_ticks
-                  p->last_accessed_time = timer_ticks ();
-                  // reset the accessed but of the page
-                  pagedir_set_accessed (pd, p->uaddr, false);
-                }
-            }
+          int64_t rate = intr_cnt - intr_cnt_second;
+          if (intr_max_rate == 0 || rate < intr_min_rate)
+            intr_min_rate = rate;
+          if (rate > intr_max_rate)
+            intr_max_rate = rate;
+          intr_cnt_second = intr_cnt;
         }
     }
-#endif
-  ticks++;
-  thread_tick ();
 
-  /* Check and wake up any threads ready to be woke up. */
-  wake_ready ();
+  /* Fire any timers that are due. */
+  while (wheel_ticks <= ticks)
+    wheel_advance ();
+
+  /* If the CPU is going idle, skip the ticks until the wheel next
+     has work to do.  Otherwise, make sure that the timer is
+     interrupting periodically. */
+  if ((!timer_tickless || !thread_is_idle () || !oneshot_start (stopped))
+      && stopped)
+    pit_configure_channel (0, 2, TIMER_FREQ);
 }
 
-/* Wake up any threads that are ready. */
-static inline void
-wake_ready (void)
+/* Programs the PIT to interrupt once, at the next tick at which
+   the timing wheel has work to do, or ONESHOT_MAX_TICKS from
+   now if that is sooner.  Returns false without changing the PIT
+   if that is the very next tick.  Called by the timer interrupt
+   handler just after a tick boundary; STOPPED says whether that
+   boundary was marked by a one-shot interrupt. */
+static bool
+oneshot_start (bool stopped)
 {
-  struct list_elem *e;
+  unsigned n = wheel_quiet_ticks (ONESHOT_MAX_TICKS);
+  uint16_t counter, since;
+
+  if (n < 2)
+    return false;
+
+  /* Count from the tick boundary that has just passed, not from
+     now.  In periodic mode the counter is counting down toward
+     the next boundary; after a one-shot it has wrapped around
+     past 0. */
+  counter = pit_read_counter (0);
+  since = stopped ? (uint16_t) -counter : PIT_PER_TICK - counter;
+  if (since >= PIT_PER_TICK)
+    since = 0;
+  oneshot_ticks = n;
+  pit_start_oneshot (0, n * PIT_PER_TICK - since);
+  return true;
+}
+
+/* Puts pending timer T into its slot in the timing wheel.
+   Interrupts must be off. */
+static void
+wheel_insert (struct timer *t)
+{
+  int64_t expires = t->expires;
+  int64_t delta;
+  int level;
 
   ASSERT (intr_get_level () == INTR_OFF);
 
-  /* Iterate thought elements in sleep_list and check if they are ready. */
-  for (e = list_begin (&sleep_list); e != list_end (&sleep_list);
-       e = list_next (e))
+  /* A timer that is already due fires at the next tick that the
+     wheel processes; one that is too far ahead waits at the far
+     end of the wheel. */
+  if (expires < wheel_ticks)
+    expires = wheel_ticks;
+  else if (expires - wheel_ticks >= WHEEL_SPAN)
+    expires = wheel_ticks + WHEEL_SPAN - 1;
+  delta = expires - wheel_ticks;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & WHEEL_MASK],
+                  &t->elem);
+}
+
+/* Returns the number of ticks from the current tick to the next
+   one at which the timing wheel has work to do, that is, timers
+   to fire or a level to cascade, or MAX if that is farther.
+   Interrupts must be off. */
+static unsigned
+wheel_quiet_ticks (unsigned max)
+{
+  unsigned n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (wheel_ticks == ticks + 1);
+
+  for (n = 1; n < max; n++)
     {
-      struct thread *t = list_entry (e, struct thread, sleepelem);
-      /* If the thread's wake_ticks member is less then or equal to
-         the current timer ticks, we can wake the thread up.
-         Otherwise, stop the iteration since threads are placed in
-         ascending order of wake_ticks. */
-      if (t->wake_ticks <= timer_ticks ())
-        {
-          /* Remove the thread from sleep_list and up the semaphore.
-             The thread will be READY. */
-          list_remove (&t->sleepelem);
-          sema_up (&t->can_wake);
-        }
-      else
-        return;
+      int64_t t = wheel_ticks + n - 1;
+      if ((t & WHEEL_MASK) == 0 || !list_empty (&wheel[0][t & WHEEL_MASK]))
+        break;
+    }
+  return n;
+}
+
+/* Moves the timers in the current slot of LEVEL down to lower
+   levels.  Interrupts must be off. */
+static void
+wheel_cascade (int level)
+{
+  struct list *slot = &wheel[level][(wheel_ticks >> (WHEEL_BITS * level))
+                                    & WHEEL_MASK];
+  struct list cascade;
+
+  list_init (&cascade);
+  if (!list_empty (slot))
+    list_splice (list_end (&cascade), list_begin (slot), list_end (slot));
+  while (!list_empty (&cascade))
+    wheel_insert (list_entry (list_pop_front (&cascade), struct timer, elem));
+}
+
+/* Processes tick wheel_ticks: cascades higher levels whose turn
+   has come, then fires the timers in the current level-0 slot.
+   Interrupts must be off. */
+static void
+wheel_advance (void)
+{
+  struct list *slot = &wheel[0][wheel_ticks & WHEEL_MASK];
+  struct list expired;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (level = 1; level < WHEEL_LEVELS; level++)
+    {
+      if (((wheel_ticks >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) != 0)
+        break;
+      wheel_cascade (level);
+    }
+
+  /* Take the expired timers off the wheel before calling any of
+     them, so that a timer function may add its timer again. */
+  list_init (&expired);
+  if (!list_empty (slot))
+    list_splice (list_end (&expired), list_begin (slot), list_end (slot));
+  wheel_ticks++;
+
+  while (!list_empty (&expired))
+    {
+      struct timer *t = list_entry (list_pop_front (&expired),
+                                    struct timer, elem);
+      t->pending = false;
+      t->func (t->aux);
     }
 }
 
@@ -0,0 +1,372 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between write-behind passes of the flusher thread. */
+#define FLUSH_PERIOD TIMER_FREQ
+
+/* Most read-ahead requests queued for the read-ahead thread.
+   Further requests are dropped until it catches up. */
+#define AHEAD_QUEUE 32
+
+/* Marks a cache entry that holds no sector. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A sector held in the buffer cache.
+
+   SECTOR, ACCESSED, AHEAD and PIN_CNT are protected by
+   cache_lock.
+   DATA, VALID and DIRTY are protected by the entry's LOCK, which
+   may be held across disk I/O.  A thread pins an entry under
+   cache_lock before it acquires the entry's LOCK, and unpins it
+   after releasing it, so an entry with PIN_CNT of 0 has no user
+   and may be given to another sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    bool accessed;                      /* Used since the clock passed. */
+    bool ahead;                         /* Read ahead, not yet used. */
+    int pin_cnt;                        /* Users and waiters. */
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* DATA holds SECTOR's contents. */
+    bool dirty;                         /* DATA is newer than the disk. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;          /* Protects the table. */
+static size_t hand;                     /* Clock hand. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Accesses found in the cache. */
+static long long miss_cnt;              /* Accesses that had to load. */
+static long long flush_cnt;             /* Dirty sectors written back. */
+static long long ahead_cnt;             /* Sectors read ahead. */
+static long long ahead_hit_cnt;         /* Read-ahead sectors then used. */
+static long long ahead_waste_cnt;       /* Evicted without being used. */
+
+/* Read-ahead requests, a ring of sectors waiting to be read into
+   the cache by the read-ahead thread. */
+static block_sector_t ahead_queue[AHEAD_QUEUE];
+static size_t ahead_head;               /* Next request to serve. */
+static size_t ahead_queued;         /* Requests in the ring. */
+static struct lock ahead_lock;          /* Protects the ring. */
+static struct condition ahead_cond;     /* Signaled on a new request. */
+
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static struct cache_entry *cache_install (block_sector_t, bool *hit);
+static struct cache_entry *cache_lookup (block_sector_t);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_evict (void);
+static void cache_clean (struct cache_entry *);
+static void cache_flush_thread (void *aux);
+static void cache_ahead_thread (void *aux);
+
+/* Initializes the buffer cache and starts its flusher and
+   read-ahead threads.  Must be called after thread_start(). */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].sector = NO_SECTOR;
+      lock_init (&cache[i].lock);
+    }
+  lock_init (&ahead_lock);
+  cond_init (&ahead_cond);
+  thread_create ("flusher", PRI_DEFAULT, cache_flush_thread, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, cache_ahead_thread, NULL);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR starting at byte OFS.
+   The write reaches the disk when the sector is evicted or
+   flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* A write of the whole sector need not read it first. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Asks the read-ahead thread to read SECTOR into the cache, and
+   returns without waiting.  The request is dropped if too many
+   are already pending. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&ahead_lock);
+  if (ahead_queued < AHEAD_QUEUE)
+    {
+      ahead_queue[(ahead_head + ahead_queued++) % AHEAD_QUEUE] = sector;
+      cond_signal (&ahead_cond, &ahead_lock);
+    }
+  lock_release (&ahead_lock);
+}
+
+/* Writes every dirty sector in the cache to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector != NO_SECTOR && cache[i].dirty)
+      cache_clean (&cache[i]);
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %lld hits, %lld misses, %lld sectors written back\n",
+          hit_cnt, miss_cnt, flush_cnt);
+  printf ("Read-ahead: %lld sectors read ahead, %lld hits, %lld wasted\n",
+          ahead_cnt, ahead_hit_cnt, ahead_waste_cnt);
+}
+
+/* Returns the cache entry for SECTOR, pinned and with its lock
+   held, giving it a new entry if it is not cached.  If LOAD is
+   true, the entry's data is read from disk if not yet valid. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+  bool hit;
+
+  lock_acquire (&cache_lock);
+  e = cache_install (sector, &hit);
+  if (!hit)
+    miss_cnt++;
+  else
+    {
+      hit_cnt++;
+      if (e->ahead)
+        {
+          ahead_hit_cnt++;
+          e->ahead = false;
+        }
+    }
+  e->accessed = true;
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (load && !e->valid)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Returns the entry holding SECTOR, giving SECTOR a new entry,
+   with data not yet valid, if it is not cached.  Sets *HIT to
+   whether it was cached.  Caller must hold cache_lock. */
+static struct cache_entry *
+cache_install (block_sector_t sector, bool *hit)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          *hit = true;
+          return e;
+        }
+
+      /* Look again if cache_evict() dropped cache_lock, in case
+         another thread cached SECTOR meanwhile. */
+      e = cache_evict ();
+      if (e != NULL)
+        {
+          if (e->ahead)
+            ahead_waste_cnt++;
+          e->sector = sector;
+          e->valid = false;
+          e->ahead = false;
+          *hit = false;
+          return e;
+        }
+    }
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if it is
+   not cached.  Caller must hold cache_lock. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Releases and unpins E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Chooses an entry to hold a new sector, using the clock
+   algorithm, and returns it unpinned and clean.  A dirty victim
+   is written back before it is reused, so that no other thread
+   can read a stale copy of its sector from disk.  Caller must
+   hold cache_lock.  Returns a null pointer if cache_lock had to
+   be released on the way, to write back a victim or to wait for
+   an entry to be unpinned. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t passed = 0;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      struct cache_entry *e = &cache[hand];
+      hand = (hand + 1) % CACHE_SIZE;
+
+      /* Every entry is in use: let their users finish. */
+      if (++passed > 2 * CACHE_SIZE)
+        {
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+          return NULL;
+        }
+
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->sector == NO_SECTOR)
+        return e;
+      if (e->accessed)
+        e->accessed = false;
+      else if (e->dirty)
+        {
+          cache_clean (e);
+          return NULL;
+        }
+      else
+        return e;
+    }
+}
+
+/* Writes E back to disk if it is dirty.  Caller must hold
+   cache_lock, which is released during the write. */
+static void
+cache_clean (struct cache_entry *e)
+{
+  bool written = false;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      written = true;
+    }
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  e->pin_cnt--;
+  if (written)
+    flush_cnt++;
+}
+
+/* Flusher thread: writes dirty sectors behind every
+   FLUSH_PERIOD ticks. */
+static void
+cache_flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_PERIOD);
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread: reads requested sectors into the cache,
+   unless they are there already. */
+static void
+cache_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+      bool hit;
+
+      lock_acquire (&ahead_lock);
+      while (ahead_queued == 0)
+        cond_wait (&ahead_cond, &ahead_lock);
+      sector = ahead_queue[ahead_head];
+      ahead_head = (ahead_head + 1) % AHEAD_QUEUE;
+      ahead_queued--;
+      lock_release (&ahead_lock);
+
+      lock_acquire (&cache_lock);
+      e = cache_install (sector, &hit);
+      if (hit)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->ahead = true;
+      e->accessed = true;
+      e->pin_cnt++;
+      ahead_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (!e->valid)
+        {
+          block_read (fs_device, sector, e->data);
+          e->valid = true;
+        }
+      cache_put (e);
+    }
+}
@@ -1,16 +1,30 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "filesys/cache.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window, in sectors.  A file_read() that starts where
+   the previous one ended is taken as part of a sequential stream,
+   and the window of sectors past it is read ahead into the buffer
+   cache.  The window starts at AHEAD_MIN and doubles with each
+   sequential read, up to AHEAD_MAX; any other read closes it. */
+#define AHEAD_MIN 2
+#define AHEAD_MAX (CACHE_SIZE / 4)
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ahead_next;           /* Where a sequential read would start. */
+    off_t ahead_end;            /* End of the bytes already read ahead. */
+    int ahead_window;           /* Read-ahead window, 0 if closed. */
   };
 
+static void file_read_ahead (struct file *, off_t ofs, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -69,6 +83,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -166,3 +181,33 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Notes that SIZE bytes were just read from FILE at offset OFS,
+   and reads ahead past them if that continues a sequential
+   stream. */
+static void
+file_read_ahead (struct file *file, off_t ofs, off_t size) 
+{
+  off_t start, end;
+
+  if (ofs != file->ahead_next || size == 0)
+    {
+      file->ahead_window = 0;
+      file->ahead_end = 0;
+    }
+  else if (file->ahead_window == 0)
+    file->ahead_window = AHEAD_MIN;
+  else if (file->ahead_window < AHEAD_MAX)
+    file->ahead_window *= 2;
+  file->ahead_next = ofs + size;
+
+  /* Read ahead whatever part of the window is not yet requested. */
+  start = file->ahead_next > file->ahead_end ? file->ahead_next
+                                             : file->ahead_end;
+  end = file->ahead_next + file->ahead_window * BLOCK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ahead_end = end;
+    }
+}
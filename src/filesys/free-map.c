@@ -1,13 +1,36 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <splay.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Free space is also kept as a tree of extents, maximal runs of
+   free sectors ordered by first sector, so that free space at or
+   after a given sector is found in O(log n) time.  The bitmap
+   stays the on-disk form and is rebuilt into extents when it is
+   read. */
+struct extent
+  {
+    struct splay_elem elem;          /* Element in extents. */
+    block_sector_t start;            /* First free sector. */
+    size_t cnt;                      /* Number of free sectors. */
+  };
+
+static struct splay extents;         /* Free extents. */
+
+static bool extent_less (const struct splay_elem *,
+                         const struct splay_elem *, void *);
+static void extents_build (void);
+static struct extent *extent_find (block_sector_t near, size_t cnt);
+static bool extent_take (struct extent *, block_sector_t, size_t);
+static void extent_give (block_sector_t, size_t);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,27 +40,46 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  splay_init (&extents, extent_less, NULL);
+  extents_build ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The sectors are placed at NEAR if
+   they are free, otherwise in the first free run after NEAR
+   that is long enough, wrapping around to the start of the disk.
+   Only the part of the free map that changed is written back.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if the free_map file could not be
+   written. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (size_t cnt, block_sector_t near, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct extent *e = extent_find (near, cnt);
+  block_sector_t sector;
+
+  if (e == NULL)
+    return false;
+
+  /* Splitting E may fail for lack of memory; take its start. */
+  sector = e->start <= near && near - e->start + cnt <= e->cnt
+           ? near : e->start;
+  if (!extent_take (e, sector, cnt))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      sector = e->start;
+      extent_take (e, sector, cnt);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (free_map_file != NULL
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      extent_give (sector, cnt);
+      return false;
+    }
+  *sectorp = sector;
+  return true;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
@@ -46,7 +88,8 @@ free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  extent_give (sector, cnt);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +101,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  extents_build ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +116,181 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file starts as a hole, so the
+     first write allocates its sectors, marking them in the free
+     map after parts of it have been written.  free_map_file is
+     only set after that write, so that those allocations do not
+     write the free map into a file that is still being filled,
+     and the bitmap is written again to record them. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Orders extents by first sector. */
+static bool
+extent_less (const struct splay_elem *a, const struct splay_elem *b,
+             void *aux UNUSED) 
+{
+  return (splay_entry (a, struct extent, elem)->start
+          < splay_entry (b, struct extent, elem)->start);
+}
+
+/* Replaces the extents with the free runs of the bitmap. */
+static void
+extents_build (void) 
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t start, end;
+
+  while (!splay_empty (&extents)) 
+    {
+      struct splay_elem *e = splay_first (&extents);
+      splay_remove (&extents, e);
+      free (splay_entry (e, struct extent, elem));
+    }
+
+  for (start = bitmap_scan (free_map, 0, 1, false);
+       start != BITMAP_ERROR && start < sector_cnt;
+       start = end < sector_cnt ? bitmap_scan (free_map, end, 1, false)
+                                : BITMAP_ERROR) 
+    {
+      struct extent *e;
+
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+      e = malloc (sizeof *e);
+      if (e == NULL)
+        PANIC ("can't allocate free map extents");
+      e->start = start;
+      e->cnt = end - start;
+      splay_insert (&extents, &e->elem);
+    }
+}
+
+/* Returns the extent that has CNT free sectors starting at NEAR,
+   or else the first one after NEAR with at least CNT sectors,
+   wrapping around to the start of the disk.  Returns a null
+   pointer if there is none.  For a single sector, which is what
+   files allocate, this is the next extent after NEAR. */
+static struct extent *
+extent_find (block_sector_t near, size_t cnt) 
+{
+  struct extent key;
+  struct splay_elem *floor, *e;
+
+  key.start = near;
+  floor = splay_floor (&extents, &key.elem);
+  if (floor != NULL)
+    {
+      struct extent *x = splay_entry (floor, struct extent, elem);
+      if (near - x->start + cnt <= x->cnt)
+        return x;
+    }
+
+  for (e = floor != NULL ? splay_next (&extents, floor)
+                         : splay_first (&extents);
+       e != NULL; e = splay_next (&extents, e))
+    if (splay_entry (e, struct extent, elem)->cnt >= cnt)
+      return splay_entry (e, struct extent, elem);
+  for (e = splay_first (&extents); e != NULL && e != floor;
+       e = splay_next (&extents, e))
+    if (splay_entry (e, struct extent, elem)->cnt >= cnt)
+      return splay_entry (e, struct extent, elem);
+  if (floor != NULL
+      && splay_entry (floor, struct extent, elem)->cnt >= cnt)
+    return splay_entry (floor, struct extent, elem);
+  return NULL;
+}
+
+/* Removes the CNT sectors starting at SECTOR, which must lie
+   within E, from the free extents.  Returns false, changing
+   nothing, if E had to be split in two and memory ran out. */
+static bool
+extent_take (struct extent *e, block_sector_t sector, size_t cnt) 
+{
+  block_sector_t end = e->start + e->cnt;
+
+  ASSERT (e->start <= sector && sector + cnt <= end);
+
+  if (sector == e->start)
+    {
+      e->start += cnt;
+      e->cnt -= cnt;
+      if (e->cnt == 0)
+        {
+          splay_remove (&extents, &e->elem);
+          free (e);
+        }
+    }
+  else if (sector + cnt == end)
+    e->cnt -= cnt;
+  else
+    {
+      struct extent *rest = malloc (sizeof *rest);
+      if (rest == NULL)
+        return false;
+      rest->start = sector + cnt;
+      rest->cnt = end - rest->start;
+      e->cnt = sector - e->start;
+      splay_insert (&extents, &rest->elem);
+    }
+  return true;
+}
+
+/* Adds the CNT sectors starting at SECTOR to the free extents,
+   merging them with the extents on either side if they touch.
+   If they touch neither and memory runs out, the sectors are
+   free in the bitmap but not reused until it is next read. */
+static void
+extent_give (block_sector_t sector, size_t cnt) 
+{
+  struct extent key;
+  struct splay_elem *e;
+  struct extent *prev = NULL, *next = NULL;
+
+  key.start = sector;
+  e = splay_floor (&extents, &key.elem);
+  if (e != NULL)
+    prev = splay_entry (e, struct extent, elem);
+  e = e != NULL ? splay_next (&extents, e) : splay_first (&extents);
+  if (e != NULL)
+    next = splay_entry (e, struct extent, elem);
+
+  if (prev != NULL && prev->start + prev->cnt == sector)
+    {
+      prev->cnt += cnt;
+      if (next != NULL && sector + cnt == next->start)
+        {
+          prev->cnt += next->cnt;
+          splay_remove (&extents, &next->elem);
+          free (next);
+        }
+    }
+  else if (next != NULL && sector + cnt == next->start)
+    {
+      next->start = sector;
+      next->cnt += cnt;
+    }
+  else
+    {
+      struct extent *x = malloc (sizeof *x);
+      if (x == NULL)
+        return;
+      x->start = sector;
+      x->cnt = cnt;
+      splay_insert (&extents, &x->elem);
+    }
+}
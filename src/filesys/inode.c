@@ -3,6 +3,7 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
@@ -10,14 +11,31 @@
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of data sectors listed directly in an inode. */
+#define DIRECT_CNT 123
+
+/* Number of sector numbers in an index sector. */
+#define INDEX_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Most data sectors an inode can address: its direct sectors,
+   those listed in its indirect sector, and those listed in the
+   indirect sectors that its doubly indirect sector lists.  That
+   is a little over 8 MB. */
+#define MAX_SECTORS (DIRECT_CNT + INDEX_CNT + INDEX_CNT * INDEX_CNT)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   Sector number 0, which holds the free map inode and is never
+   file data, marks an index entry with no sector allocated.  A
+   data sector that is missing is a hole, which reads as zeros. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t direct[DIRECT_CNT];  /* Data sectors. */
+    block_sector_t indirect;            /* Index of more data sectors. */
+    block_sector_t doubly_indirect;     /* Index of indirect sectors. */
+    uint32_t unused[1];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -39,18 +57,136 @@ struct inode
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, as close after NEAR as there is one free,
+   and zeros it in the buffer cache.
+   Returns the sector, or 0 if the disk is full. */
+static block_sector_t
+sector_allocate (block_sector_t near) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+
+  if (!free_map_allocate (1, near, &sector))
+    return 0;
+  cache_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  return sector;
+}
+
+/* Returns the sector number in *SLOT.  If it is 0 and NEAR is
+   not, first allocates a zeroed sector near NEAR and stores its
+   number in *SLOT.  Returns 0 if there is no sector. */
+static block_sector_t
+slot_get (block_sector_t *slot, block_sector_t near) 
+{
+  if (*slot == 0 && near != 0)
+    *slot = sector_allocate (near);
+  return *slot;
+}
+
+/* Returns entry I of index sector INDEX, like slot_get(). */
+static block_sector_t
+index_get (block_sector_t index, size_t i, block_sector_t near) 
+{
+  block_sector_t sector;
+
+  cache_read (index, &sector, i * sizeof sector, sizeof sector);
+  if (sector == 0 && near != 0)
+    {
+      sector = sector_allocate (near);
+      if (sector != 0)
+        cache_write (index, &sector, i * sizeof sector, sizeof sector);
+    }
+  return sector;
+}
+
+/* Returns the sector holding data sector IDX of DISK, or 0 if
+   there is none.  If NEAR is not 0, allocates the data sector
+   and any index sectors on the way that are missing, near NEAR,
+   so that 0 is returned only if the disk is full or IDX is too
+   large.  Caller must write DISK back if it may have changed. */
+static block_sector_t
+index_to_sector (struct inode_disk *disk, size_t idx, block_sector_t near) 
+{
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return slot_get (&disk->direct[idx], near);
+  idx -= DIRECT_CNT;
+
+  if (idx < INDEX_CNT)
+    {
+      index = slot_get (&disk->indirect, near);
+      return index != 0 ? index_get (index, idx, near) : 0;
+    }
+  idx -= INDEX_CNT;
+
+  if (idx < INDEX_CNT * INDEX_CNT)
+    {
+      index = slot_get (&disk->doubly_indirect, near);
+      if (index != 0)
+        index = index_get (index, idx / INDEX_CNT, near);
+      return index != 0 ? index_get (index, idx % INDEX_CNT, near) : 0;
+    }
+  return 0;
+}
+
+/* Frees SECTOR, if it is not 0.  If LEVEL is greater than 0,
+   SECTOR is an index sector, and the sectors it lists are first
+   freed at LEVEL - 1. */
+static void
+index_release (block_sector_t sector, int level) 
+{
+  size_t i;
+
+  if (sector == 0)
+    return;
+  if (level > 0)
+    for (i = 0; i < INDEX_CNT; i++)
+      index_release (index_get (sector, i, 0), level - 1);
+  free_map_release (sector, 1);
+}
+
+/* Frees all the data and index sectors of DISK. */
+static void
+inode_release (struct inode_disk *disk) 
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    index_release (disk->direct[i], 0);
+  index_release (disk->indirect, 1);
+  index_release (disk->doubly_indirect, 2);
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns 0 if INODE has no sector there: POS lies in a hole, or
+   past end of file.  If CREATE is true, a missing sector is
+   allocated instead, so 0 is returned only if the disk is full
+   or POS is beyond the largest file size. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool create) 
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector, near;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  if (!create)
+    return pos < inode->data.length
+           ? index_to_sector (&inode->data, idx, 0) : 0;
+
+  sector = index_to_sector (&inode->data, idx, 0);
+  if (sector == 0)
+    {
+      /* Place the new sector right after the one before it, or
+         after the inode itself. */
+      near = idx > 0 ? index_to_sector (&inode->data, idx - 1, 0) : 0;
+      if (near == 0)
+        near = inode->sector;
+      sector = index_to_sector (&inode->data, idx, near + 1);
+      cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+  return sector;
 }
 
 /* List of open inodes, so that opening a single inode twice
@@ -66,9 +202,11 @@ inode_init (void)
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data is a hole, which reads as zeros and gets
+   sectors as it is written, so no data sector is allocated.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is larger
+   than an inode can address. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
@@ -81,25 +219,16 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (bytes_to_sectors (length) > MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+      success = true;
       free (disk_inode);
     }
   return success;
@@ -137,7 +266,7 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
   return inode;
 }
 
@@ -177,8 +306,7 @@ inode_close (struct inode *inode)
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          inode_release (&inode->data);
         }
 
       free (inode); 
@@ -196,18 +324,18 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Holes read as zeros. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,47 +348,50 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Asks for the sectors of INODE holding bytes OFFSET through
+   OFFSET + SIZE - 1, as far as they are within the file and not
+   holes, to be read into the buffer cache in the background. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE);
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, false);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or an error occurs.
+   Sectors are allocated as they are first written.  A write past
+   end of file extends the inode, leaving any gap as a hole. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -268,51 +399,31 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, true);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* A partial sector is read into the cache first. */
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file over what was written past its end. */
+  if (offset > inode_length (inode))
+    {
+      inode->data.length = offset;
+      cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
 
   return bytes_written;
 }
@@ -0,0 +1,187 @@
+/* Priority queue.
+
+   See heap.h for basic information.
+
+   The heap is a pairing heap.  Each element points to its first
+   child and to its next sibling; its `prev' member points to its
+   previous sibling or, for a first child, to its parent.  The
+   root has no siblings and a null `prev'.
+
+   Inserting melds a one-element heap with the root.  Removing
+   an element melds its children pairwise from left to right and
+   then melds the resulting heaps from right to left, which gives
+   the O(log n) amortized bound. */
+
+#include "heap.h"
+#include "../debug.h"
+
+static struct heap_elem *meld (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+
+/* Initializes H as an empty heap that compares elements using
+   LESS, given auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux)
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->elem_cnt = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (const struct heap *h)
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+heap_empty (const struct heap *h)
+{
+  return h->root == NULL;
+}
+
+/* Returns the maximum element in H, without removing it.
+   H must not be empty.  If several elements are equal, returns
+   an arbitrary one of them. */
+struct heap_elem *
+heap_max (const struct heap *h)
+{
+  ASSERT (!heap_empty (h));
+  return h->root;
+}
+
+/* Inserts E into H. */
+void
+heap_push (struct heap *h, struct heap_elem *e)
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  h->root = h->root != NULL ? meld (h, h->root, e) : e;
+  h->elem_cnt++;
+}
+
+/* Removes and returns the maximum element in H, which must not
+   be empty. */
+struct heap_elem *
+heap_pop_max (struct heap *h)
+{
+  struct heap_elem *max;
+
+  ASSERT (!heap_empty (h));
+
+  max = h->root;
+  h->root = merge_pairs (h, max->child);
+  h->elem_cnt--;
+  return max;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e)
+{
+  struct heap_elem *subtree;
+
+  ASSERT (!heap_empty (h));
+
+  if (e == h->root)
+    {
+      heap_pop_max (h);
+      return;
+    }
+
+  /* Unlink E, with its children, from its parent or previous
+     sibling. */
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+
+  /* Put E's children back. */
+  subtree = merge_pairs (h, e->child);
+  if (subtree != NULL)
+    h->root = meld (h, h->root, subtree);
+  h->elem_cnt--;
+}
+
+/* Restores E's position in H after its key has changed. */
+void
+heap_update (struct heap *h, struct heap_elem *e)
+{
+  heap_remove (h, e);
+  heap_push (h, e);
+}
+
+/* Melds the heaps rooted at A and B, neither of which may have
+   siblings, and returns the root of the result. */
+static struct heap_elem *
+meld (struct heap *h, struct heap_elem *a, struct heap_elem *b)
+{
+  if (h->less (a, b, h->aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  /* Make B the first child of A. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Melds the sibling list that starts at FIRST into a single heap
+   and returns its root, or a null pointer if FIRST is null. */
+static struct heap_elem *
+merge_pairs (struct heap *h, struct heap_elem *first)
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  /* First pass: meld siblings in pairs, left to right.  The
+     results are chained through `next' in reverse order. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = first->next;
+      struct heap_elem *pair;
+
+      a->prev = a->next = NULL;
+      if (b != NULL)
+        {
+          first = b->next;
+          b->prev = b->next = NULL;
+          pair = meld (h, a, b);
+        }
+      else
+        {
+          first = NULL;
+          pair = a;
+        }
+      pair->next = pairs;
+      pairs = pair;
+    }
+
+  /* Second pass: meld the pairs, right to left. */
+  while (pairs != NULL)
+    {
+      struct heap_elem *next = pairs->next;
+      pairs->next = NULL;
+      root = root != NULL ? meld (h, root, pairs) : pairs;
+      pairs = next;
+    }
+  return root;
+}
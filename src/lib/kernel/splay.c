@@ -0,0 +1,234 @@
+/* Ordered tree.
+
+   See splay.h for basic information.
+
+   The tree is a splay tree, restructured from the top down as
+   described by Sleator and Tarjan, "Self-Adjusting Binary Search
+   Trees", JACM 32(3), 1985.  Elements need no parent pointers:
+   every operation first splays the element nearest its key to
+   the root and then works there. */
+
+#include "splay.h"
+#include "../debug.h"
+
+static struct splay_elem *splay (struct splay *, struct splay_elem *root,
+                                 const struct splay_elem *key);
+
+/* Initializes T as an empty tree that compares elements using
+   LESS, given auxiliary data AUX. */
+void
+splay_init (struct splay *t, splay_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Returns the number of elements in T. */
+size_t
+splay_size (const struct splay *t)
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+splay_empty (const struct splay *t)
+{
+  return t->root == NULL;
+}
+
+/* Inserts NEW into T and returns a null pointer, if no equal
+   element is already in T.  If an equal element is already in
+   T, returns it without inserting NEW. */
+struct splay_elem *
+splay_insert (struct splay *t, struct splay_elem *new)
+{
+  struct splay_elem *root;
+
+  ASSERT (t != NULL);
+  ASSERT (new != NULL);
+
+  root = t->root = splay (t, t->root, new);
+  if (root == NULL)
+    new->left = new->right = NULL;
+  else if (t->less (new, root, t->aux))
+    {
+      new->left = root->left;
+      new->right = root;
+      root->left = NULL;
+    }
+  else if (t->less (root, new, t->aux))
+    {
+      new->right = root->right;
+      new->left = root;
+      root->right = NULL;
+    }
+  else
+    return root;
+
+  t->root = new;
+  t->elem_cnt++;
+  return NULL;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+splay_remove (struct splay *t, struct splay_elem *e)
+{
+  struct splay_elem *root;
+
+  ASSERT (!splay_empty (t));
+
+  root = splay (t, t->root, e);
+  ASSERT (root == e);
+
+  /* Splaying the left subtree for E, which is greater than all
+     of it, brings its maximum to its root, which then has no
+     right child. */
+  if (root->left == NULL)
+    t->root = root->right;
+  else
+    {
+      t->root = splay (t, root->left, e);
+      t->root->right = root->right;
+    }
+  t->elem_cnt--;
+}
+
+/* Finds and returns an element equal to KEY in T, or a null
+   pointer if no equal element exists in T. */
+struct splay_elem *
+splay_find (struct splay *t, const struct splay_elem *key)
+{
+  struct splay_elem *root = t->root = splay (t, t->root, key);
+
+  if (root == NULL
+      || t->less (key, root, t->aux) || t->less (root, key, t->aux))
+    return NULL;
+  return root;
+}
+
+/* Returns the greatest element in T that is less than or equal
+   to KEY, or a null pointer if every element is greater than
+   KEY. */
+struct splay_elem *
+splay_floor (struct splay *t, const struct splay_elem *key)
+{
+  struct splay_elem *root = t->root = splay (t, t->root, key);
+  struct splay_elem *e;
+
+  /* Splaying leaves KEY's predecessor or successor at the root. */
+  if (root == NULL || !t->less (key, root, t->aux))
+    return root;
+  e = root->left;
+  if (e != NULL)
+    while (e->right != NULL)
+      e = e->right;
+  return e;
+}
+
+/* Returns the least element in T, or a null pointer if T is
+   empty. */
+struct splay_elem *
+splay_first (struct splay *t)
+{
+  struct splay_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->left != NULL)
+      e = e->left;
+  return e;
+}
+
+/* Returns the element that follows E, which must be in T, or a
+   null pointer if E is the greatest element of T.  T must not be
+   modified between calls that walk it this way, other than by
+   removing the element just returned. */
+struct splay_elem *
+splay_next (struct splay *t, struct splay_elem *e)
+{
+  struct splay_elem *next;
+
+  t->root = splay (t, t->root, e);
+  ASSERT (t->root == e);
+  next = e->right;
+  if (next != NULL)
+    while (next->left != NULL)
+      next = next->left;
+  return next;
+}
+
+/* Splays the subtree of T rooted at ROOT for KEY, returning its
+   new root.  This is an element equal to KEY if there is one,
+   and otherwise the last element on KEY's search path, which is
+   KEY's predecessor or successor in the subtree. */
+static struct splay_elem *
+splay (struct splay *t, struct splay_elem *root,
+       const struct splay_elem *key)
+{
+  struct splay_elem header;
+  struct splay_elem *l, *r, *y;
+
+  if (root == NULL)
+    return NULL;
+
+  /* L and R are the rightmost element of the left tree and the
+     leftmost element of the right tree, both kept in HEADER. */
+  header.left = header.right = NULL;
+  l = r = &header;
+  for (;;)
+    {
+      if (t->less (key, root, t->aux))
+        {
+          if (root->left == NULL)
+            break;
+          if (t->less (key, root->left, t->aux))
+            {
+              /* Rotate right. */
+              y = root->left;
+              root->left = y->right;
+              y->right = root;
+              root = y;
+              if (root->left == NULL)
+                break;
+            }
+          /* Link right. */
+          r->left = root;
+          r = root;
+          root = root->left;
+        }
+      else if (t->less (root, key, t->aux))
+        {
+          if (root->right == NULL)
+            break;
+          if (t->less (root->right, key, t->aux))
+            {
+              /* Rotate left. */
+              y = root->right;
+              root->right = y->left;
+              y->left = root;
+              root = y;
+              if (root->right == NULL)
+                break;
+            }
+          /* Link left. */
+          l->right = root;
+          l = root;
+          root = root->right;
+        }
+      else
+        break;
+    }
+
+  /* Assemble. */
+  l->right = root->left;
+  r->left = root->right;
+  root->left = header.right;
+  root->right = header.left;
+  return root;
+}
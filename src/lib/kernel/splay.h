@@ -0,0 +1,70 @@
+#ifndef __LIB_KERNEL_SPLAY_H
+#define __LIB_KERNEL_SPLAY_H
+
+/* Ordered tree.
+
+   This is a splay tree: a binary search tree ordered by a
+   caller-supplied comparison function that moves each element it
+   looks up to the root.  Operations take O(log n) amortized time,
+   and repeated lookups near the same key are cheap.
+
+   Like the list and hash implementations, the tree does not use
+   dynamic allocation.  Each structure that can potentially be in
+   a tree must embed a struct splay_elem member, and the
+   splay_entry macro converts a struct splay_elem back to the
+   structure object that contains it.  Refer to lib/kernel/list.h
+   for a detailed explanation of the technique.
+
+   Lookups take a "key" element, which need only have the members
+   that the comparison function examines filled in, as with
+   hash_find(). */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct splay_elem
+  {
+    struct splay_elem *left;    /* Lesser elements. */
+    struct splay_elem *right;   /* Greater elements. */
+  };
+
+/* Converts pointer to tree element SPLAY_ELEM into a pointer to
+   the structure that SPLAY_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define splay_entry(SPLAY_ELEM, STRUCT, MEMBER)         \
+        ((STRUCT *) ((uint8_t *) (SPLAY_ELEM)           \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool splay_less_func (const struct splay_elem *a,
+                              const struct splay_elem *b,
+                              void *aux);
+
+/* Tree. */
+struct splay
+  {
+    struct splay_elem *root;    /* Root, or null if empty. */
+    size_t elem_cnt;            /* Number of elements in tree. */
+    splay_less_func *less;      /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void splay_init (struct splay *, splay_less_func *, void *aux);
+
+size_t splay_size (const struct splay *);
+bool splay_empty (const struct splay *);
+
+struct splay_elem *splay_insert (struct splay *, struct splay_elem *);
+void splay_remove (struct splay *, struct splay_elem *);
+
+struct splay_elem *splay_find (struct splay *, const struct splay_elem *);
+struct splay_elem *splay_floor (struct splay *, const struct splay_elem *);
+struct splay_elem *splay_first (struct splay *);
+struct splay_elem *splay_next (struct splay *, struct splay_elem *);
+
+#endif /* lib/kernel/splay.h */
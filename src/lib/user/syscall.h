@@ -24,6 +24,7 @@ void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
 int wait (pid_t);
+pid_t fork (void);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
@@ -0,0 +1,83 @@
+/* Measures how long timer_sleep() keeps interrupts off while it
+   queues the sleeping thread, as the number of other sleepers
+   grows from 16 to 4,096.  With the timing wheel this cost does
+   not depend on the number of sleepers.
+
+   Each measurement times the interrupts-off section that
+   timer_sleep() runs, timer_add(), in CPU cycles.  The other
+   sleepers are timers due at scattered times in the future,
+   which cost the wheel the same as sleeping threads do.  The
+   cycle counts vary between runs, so only completion is
+   checked. */
+
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/devices/tests.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/tsc.h"
+#include "devices/timer.h"
+
+#define MAX_SLEEPERS 4096               /* Largest number of sleepers. */
+#define TRIALS 64                       /* Measurements per count. */
+
+static void
+no_op (void *aux UNUSED)
+{
+}
+
+void
+test_alarm_scale (void)
+{
+  struct timer *sleepers;
+  int sleeper_cnt = 0;
+  int n, i;
+
+  sleepers = malloc (sizeof *sleepers * MAX_SLEEPERS);
+  if (sleepers == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  for (n = 16; n <= MAX_SLEEPERS; n *= 4)
+    {
+      uint64_t total = 0, worst = 0;
+
+      for (; sleeper_cnt < n; sleeper_cnt++)
+        {
+          struct timer *t = &sleepers[sleeper_cnt];
+          timer_setup (t, no_op, NULL);
+          timer_add (t, timer_ticks () + 1000 + random_ulong () % 100000);
+        }
+
+      for (i = 0; i < TRIALS; i++)
+        {
+          struct timer t;
+          int64_t expires = timer_ticks () + 1 + random_ulong () % 1000;
+          enum intr_level old_level;
+          uint64_t start, cycles;
+
+          timer_setup (&t, no_op, NULL);
+          old_level = intr_disable ();
+          start = rdtsc ();
+          timer_add (&t, expires);
+          cycles = rdtsc () - start;
+          intr_set_level (old_level);
+          timer_cancel (&t);
+
+          total += cycles;
+          if (cycles > worst)
+            worst = cycles;
+        }
+      msg ("%d sleepers: %"PRIu64" cycles average, %"PRIu64" worst.",
+           n, total / TRIALS, worst);
+
+      /* Sleeping still works with this many timers pending. */
+      timer_sleep (1);
+    }
+
+  for (i = 0; i < sleeper_cnt; i++)
+    if (!timer_cancel (&sleepers[i]))
+      fail ("sleeper %d fired early", i);
+  free (sleepers);
+  pass ();
+}
@@ -16,6 +16,7 @@ static const struct test tests[] =
     {"alarm-simultaneous", test_alarm_simultaneous},
     {"alarm-zero", test_alarm_zero},
     {"alarm-negative", test_alarm_negative},
+    {"alarm-scale", test_alarm_scale},
   };
 
 static const char *test_name;
@@ -10,6 +10,7 @@ extern test_func test_alarm_multiple;
 extern test_func test_alarm_simultaneous;
 extern test_func test_alarm_zero;
 extern test_func test_alarm_negative;
+extern test_func test_alarm_scale;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,34 @@
+/* Grows a file from nothing, writing it sequentially one block
+   at a time and checking its size after each write, past the
+   sectors its inode lists directly, then reads it back to verify
+   that it was written properly. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[72943];
+
+static size_t
+return_block_size (void) 
+{
+  return 1234;
+}
+
+static void
+check_file_size (int fd, long ofs) 
+{
+  long size = filesize (fd);
+  if (size != ofs)
+    fail ("filesize not updated properly: should be %ld, actually %ld",
+          ofs, size);
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testme",
+            buf, sizeof buf, 0,
+            return_block_size, check_file_size);
+}
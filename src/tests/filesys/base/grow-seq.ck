@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seq) begin
+(grow-seq) create "testme"
+(grow-seq) open "testme"
+(grow-seq) writing "testme"
+(grow-seq) close "testme"
+(grow-seq) open "testme" for verification
+(grow-seq) verified contents of "testme"
+(grow-seq) close "testme"
+(grow-seq) end
+EOF
+pass;
@@ -0,0 +1,29 @@
+/* Creates an empty file, seeks far past its end and writes a
+   single byte there, then checks that the file grew to cover
+   it and that the hole before it reads back as zeros. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[76543];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  char byte = 'x';
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, sizeof buf - 1);
+  CHECK (write (fd, &byte, 1) == 1, "write \"%s\"", file_name);
+  CHECK (filesize (fd) == (int) sizeof buf, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  buf[sizeof buf - 1] = byte;
+  check_file (file_name, buf, sizeof buf);
+}
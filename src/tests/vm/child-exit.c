@@ -0,0 +1,12 @@
+/* Child process of fork-exec.
+   Exits at once with code 0x42. */
+
+#include "tests/lib.h"
+
+const char *test_name = "child-exit";
+
+int
+main (void)
+{
+  return 0x42;
+}
@@ -0,0 +1,41 @@
+/* Times the usual way of starting a program from a large
+   process: the parent, holding a 256 kB dirty buffer, forks a
+   child that execs child-exit and passes on its exit status.
+   Nothing of the shared address space is written before the
+   child exits, so the average also shows what exec costs on
+   top of fork-exit. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FORK_CNT 16                     /* Forks timed. */
+#define BUF_SIZE (256 * 1024)           /* Size of the dirtied buffer. */
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void)
+{
+  uint64_t start, cycles;
+  int n;
+
+  memset (buf, 0x5a, sizeof buf);
+
+  start = read_tsc ();
+  for (n = 0; n < FORK_CNT; n++)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        exit (wait (exec ("child-exit")));
+      if (pid == PID_ERROR)
+        fail ("fork %d failed", n);
+      if (wait (pid) != 0x42)
+        fail ("wrong exit code from child %d", n);
+    }
+  cycles = read_tsc () - start;
+  msg ("fork+exec took %llu cycles on average",
+       (unsigned long long) (cycles / FORK_CNT));
+}
@@ -0,0 +1,54 @@
+/* Forks a process with a 256 kB dirty buffer, lets the child
+   overwrite the buffer and checks that the parent's copy is
+   unchanged.  Then times FORK_CNT forks of children that exit at
+   once, the cost of sharing the address space copy-on-write and
+   tearing it down again untouched, and reports the average. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FORK_CNT 64                     /* Forks timed. */
+#define BUF_SIZE (256 * 1024)           /* Size of the dirtied buffer. */
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void)
+{
+  uint64_t start, cycles;
+  pid_t pid;
+  size_t i;
+  int n;
+
+  memset (buf, 0x5a, sizeof buf);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      memset (buf, 0, sizeof buf);
+      exit (0x42);
+    }
+  CHECK (pid != PID_ERROR, "fork");
+  CHECK (wait (pid) == 0x42, "wait for child");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu changed by child", i);
+
+  start = read_tsc ();
+  for (n = 0; n < FORK_CNT; n++)
+    {
+      pid = fork ();
+      if (pid == 0)
+        exit (n);
+      if (pid == PID_ERROR)
+        fail ("fork %d failed", n);
+      if (wait (pid) != n)
+        fail ("wrong exit code from child %d", n);
+    }
+  cycles = read_tsc () - start;
+  msg ("fork+exit took %llu cycles on average",
+       (unsigned long long) (cycles / FORK_CNT));
+}
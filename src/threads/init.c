@@ -31,6 +31,7 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #else
 #include "tests/threads/tests.h"
 #endif
@@ -134,6 +135,7 @@ main (void)
 
 #ifdef USERPROG
   swap_init ();
+  frame_start ();
 #endif
 
   printf ("Boot complete.\n");
@@ -265,9 +267,17 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-clock-spread"))
+        frame_clock_spread = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_limit = atoi (value);
+      else if (!strcmp (name, "-fault-around"))
+        page_fault_around = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -388,8 +398,12 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer interrupt while idle.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -clock-spread=N    Keep eviction clock hands N frames apart.\n"
+          "  -zswap=PAGES       Keep up to PAGES pages of compressed swap in RAM.\n"
+          "  -fault-around=N    Map up to N file pages ahead of a fault.\n"
 #endif
           );
   shutdown_power_off ();
@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -23,9 +24,18 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct thread priorities. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level, and bit N of
+   ready_bitmap is set iff ready_queues[N] is non-empty, so
+   inserting a thread and finding the highest-priority ready
+   thread are both constant-time. */
+static struct list ready_queues[PRI_CNT];
+static uint32_t ready_bitmap[PRI_CNT / 32];
+static unsigned ready_thread_cnt;       /* # of threads in run queue. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -53,6 +63,10 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
+/* Run queue statistics, per priority level. */
+static unsigned ready_cnt[PRI_CNT];     /* # of threads queued now. */
+static long long dispatch_cnt[PRI_CNT]; /* # of times chosen to run. */
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
@@ -62,11 +76,31 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* 4.4BSD scheduler state.  The timer interrupt only ever
+   touches the running thread; the once-a-second decay of every
+   thread's recent_cpu is done by mlfqs_thread.  See mlfqs_tick()
+   and mlfqs_decay_thread(). */
+#define MLFQS_BATCH 8                   /* Threads decayed per batch. */
+static fixed_t load_avg;                /* System load average. */
+static fixed_t recent_cpu_decay;        /* This second's decay factor. */
+static unsigned mlfqs_epoch;            /* Seconds since boot. */
+static struct semaphore mlfqs_sema;     /* Up'd once a second. */
+static struct thread *mlfqs_thread;     /* Runs mlfqs_decay_thread(). */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_queue_push (struct thread *);
+static struct thread *ready_queue_pop (void);
+static void ready_queue_remove (struct thread *);
+static int ready_queue_max_priority (void);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_decay_thread (void *aux UNUSED);
+static void mlfqs_catch_up (struct thread *);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_update_priority (struct thread *);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -94,11 +128,15 @@ static bool list_less_child (const struct list_elem *a,
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
+  sema_init (&mlfqs_sema, 0);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -116,6 +154,8 @@ thread_start (void)
   struct semaphore idle_started;
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
+  if (thread_mlfqs)
+    thread_create ("mlfqs", PRI_MAX, mlfqs_decay_thread, NULL);
 
   /* Start preemptive thread scheduling. */
   intr_enable ();
@@ -125,11 +165,14 @@ thread_start (void)
 }
 
 /* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+   Thus, this function runs in an external interrupt context.
+   IDLE is true for a tick that passed while the timer was
+   stopped for an idle CPU, which is charged to the idle thread
+   rather than to whichever thread is running now. */
 void
-thread_tick (void) 
+thread_tick (bool idle) 
 {
-  struct thread *t = thread_current ();
+  struct thread *t = idle ? idle_thread : thread_current ();
 
   /* Update statistics. */
   if (t == idle_thread)
@@ -141,17 +184,37 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (!idle && ++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Returns true if the CPU is idle, that is, if the idle thread
+   is running and no thread is ready to run.  Interrupts must be
+   off. */
+bool
+thread_is_idle (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return thread_current () == idle_thread && ready_thread_cnt == 0;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
+  int i;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  for (i = PRI_MAX; i >= PRI_MIN; i--)
+    if (dispatch_cnt[i] > 0 || ready_cnt[i] > 0)
+      printf ("Run queue: priority %d: %lld dispatches, %u ready\n",
+              i, dispatch_cnt[i], ready_cnt[i]);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -166,9 +229,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, the running thread yields to it immediately. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -226,12 +288,15 @@ thread_create (const char *name, int priority,
   list_insert_ordered (&thread_current ()->children, &child->childtidelem,
                        list_less_child, NULL);
 
+#ifdef USERPROG
   add_status(tid);
+#endif
 
   intr_set_level (old_level);
 
   /* Add to run queue. */
   thread_unblock (t);
+  thread_preempt ();
 
   return tid;
 }
@@ -279,7 +344,9 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  if (thread_mlfqs)
+    mlfqs_update_priority (t);
+  ready_queue_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -350,12 +417,35 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    {
+      if (thread_mlfqs)
+        mlfqs_update_priority (cur);
+      ready_queue_push (cur);
+    }
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread.  In an interrupt handler, the yield is
+   deferred until the handler returns. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level = intr_disable ();
+  bool yield = ready_queue_max_priority () > thread_current ()->priority;
+  intr_set_level (old_level);
+
+  if (yield)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -373,11 +463,81 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  Its
+   effective priority stays raised while a higher priority is
+   donated to it.  Ignored when the 4.4BSD scheduler is in use. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_refresh_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue list if it is ready or to its new place in
+   the wait heap it is blocked on.  Does not preempt the running
+   thread.  Interrupts must be off. */
+void
+thread_update_priority (struct thread *t, int priority)
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (priority == t->priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_queue_remove (t);
+      t->priority = priority;
+      ready_queue_push (t);
+    }
+  else
+    {
+      t->priority = priority;
+      if (t->status == THREAD_BLOCKED && t->wait_heap != NULL)
+        heap_update (t->wait_heap, &t->waitelem);
+    }
+}
+
+/* Recomputes T's effective priority as the greater of its base
+   priority and the priorities of the threads waiting for locks
+   that T holds.  Interrupts must be off. */
+void
+thread_refresh_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      struct heap *waiters = &lock->semaphore.waiters;
+
+      if (!heap_empty (waiters))
+        {
+          struct thread *waiter = heap_entry (heap_max (waiters),
+                                              struct thread, waitelem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  thread_update_priority (t, priority);
 }
 
 /* Returns the current thread's priority. */
@@ -387,35 +547,198 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority and yields if it no longer has the highest priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  else if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int recent_cpu;
+
+  old_level = intr_disable ();
+  mlfqs_catch_up (cur);
+  recent_cpu = fp_round (cur->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent_cpu;
+}
+
+/* 4.4BSD scheduler work done at each timer tick for the running
+   thread T.  Runs in an external interrupt context, and does a
+   constant amount of work however many threads exist:
+
+     - T's recent_cpu is charged one tick.
+
+     - Every fourth tick, T's priority is recomputed.  The
+       priorities of other threads cannot have changed since
+       they last ran, because neither their recent_cpu nor their
+       nice value has.
+
+     - Once a second, load_avg and the decay factor for
+       recent_cpu are updated and mlfqs_thread is woken to apply
+       the decay to every thread outside the interrupt handler. */
+static void
+mlfqs_tick (struct thread *t)
+{
+  int64_t ticks = timer_ticks ();
+
+  if (t != idle_thread)
+    t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      int ready_threads = ready_thread_cnt + (t != idle_thread);
+      fixed_t twice_load;
+
+      if (mlfqs_thread != NULL && mlfqs_thread->status != THREAD_BLOCKED)
+        ready_threads--;
+      load_avg = (59 * load_avg + fp_from_int (ready_threads)) / 60;
+      twice_load = 2 * load_avg;
+      recent_cpu_decay = fp_div (twice_load, fp_add_int (twice_load, 1));
+      mlfqs_epoch++;
+
+      sema_up (&mlfqs_sema);
+      intr_yield_on_return ();
+    }
+  else if (ticks % 4 == 0)
+    {
+      mlfqs_update_priority (t);
+      thread_preempt ();
+    }
+}
+
+/* Thread function for mlfqs_thread.  Each time the timer
+   interrupt starts a new second, decays the recent_cpu of every
+   thread and recomputes its priority.
+
+   Threads are handled MLFQS_BATCH at a time with interrupts
+   off, so the time spent with interrupts disabled stays small
+   however many threads exist.  Each decayed thread is moved to
+   the back of all_list, and new threads inherit their parent's
+   epoch, so the threads still to be decayed always form a
+   prefix of all_list and no cursor needs to survive across
+   batches. */
+static void
+mlfqs_decay_thread (void *aux UNUSED) 
+{
+  mlfqs_thread = thread_current ();
+  mlfqs_thread->priority = PRI_MAX;
+
+  for (;;) 
+    {
+      bool done = false;
+
+      sema_down (&mlfqs_sema);
+      while (!done)
+        {
+          enum intr_level old_level = intr_disable ();
+          int i;
+
+          for (i = 0; i < MLFQS_BATCH && !done; i++)
+            {
+              struct thread *t = list_entry (list_front (&all_list),
+                                             struct thread, allelem);
+              if (t->mlfqs_epoch == mlfqs_epoch)
+                done = true;
+              else
+                {
+                  mlfqs_catch_up (t);
+                  mlfqs_update_priority (t);
+                  list_remove (&t->allelem);
+                  list_push_back (&all_list, &t->allelem);
+                }
+            }
+          intr_set_level (old_level);
+        }
+    }
+}
+
+/* Applies the per-second recent_cpu decay to T for every second
+   boundary that has passed since T was last decayed.  Normally
+   this is at most one.  Interrupts must be off. */
+static void
+mlfqs_catch_up (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (t->mlfqs_epoch != mlfqs_epoch)
+    {
+      t->recent_cpu = fp_add_int (fp_mul (recent_cpu_decay, t->recent_cpu),
+                                  t->nice);
+      t->mlfqs_epoch++;
+    }
+}
+
+/* Returns the 4.4BSD priority for T, computed from its
+   recent_cpu and nice values. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  fixed_t pri = fp_sub_int (fp_from_int (PRI_MAX) - t->recent_cpu / 4,
+                            t->nice * 2);
+  int priority = fp_to_int (pri);
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  else if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Recomputes T's priority, moving T to the matching run queue
+   list if it is ready.  The idle thread and mlfqs_thread keep
+   their fixed priorities.  Interrupts must be off. */
+static void
+mlfqs_update_priority (struct thread *t) 
+{
+  int priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t == idle_thread || t == mlfqs_thread)
+    return;
+
+  priority = mlfqs_priority (t);
+  t->base_priority = priority;
+  thread_update_priority (t, priority);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -504,11 +827,31 @@ init_thread (struct thread *t, const char *name, int priority)
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
+  if (thread_mlfqs)
+    {
+      /* The initial thread starts with nice and recent_cpu of
+         zero; other threads inherit them from their parent. */
+      if (t != initial_thread)
+        {
+          struct thread *parent = running_thread ();
+          t->nice = parent->nice;
+          t->recent_cpu = parent->recent_cpu;
+          t->mlfqs_epoch = parent->mlfqs_epoch;
+        }
+      t->priority = mlfqs_priority (t);
+    }
+  t->base_priority = t->priority;
+  list_init (&t->held_locks);
   /* Initialise the thread's lists. */
   list_init (&t->children);
   list_init (&t->files);
   list_init (&t->mapids);
+#ifdef USERPROG
   t->active_proc = false;
+  t->page_table = NULL;
+  t->fault_next = NULL;
+  t->fault_window = 0;
+#endif
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable ();
@@ -537,10 +880,77 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  struct thread *t = ready_queue_pop ();
+  return t != NULL ? t : idle_thread;
+}
+
+/* Appends T to the run queue list for its priority.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t)
+{
+  int pri = t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= pri && pri <= PRI_MAX);
+
+  list_push_back (&ready_queues[pri], &t->elem);
+  ready_bitmap[pri / 32] |= 1u << (pri % 32);
+  ready_cnt[pri]++;
+  ready_thread_cnt++;
+}
+
+/* Removes ready thread T from the run queue.
+   Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  int pri = t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[pri]))
+    ready_bitmap[pri / 32] &= ~(1u << (pri % 32));
+  ready_cnt[pri]--;
+  ready_thread_cnt--;
+}
+
+/* Removes and returns the first thread in the highest-priority
+   non-empty run queue list, or a null pointer if no thread is
+   ready.  Interrupts must be off. */
+static struct thread *
+ready_queue_pop (void)
+{
+  int pri = ready_queue_max_priority ();
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pri < PRI_MIN)
+    return NULL;
+
+  t = list_entry (list_pop_front (&ready_queues[pri]), struct thread, elem);
+  if (list_empty (&ready_queues[pri]))
+    ready_bitmap[pri / 32] &= ~(1u << (pri % 32));
+  ready_cnt[pri]--;
+  ready_thread_cnt--;
+  dispatch_cnt[pri]++;
+  return t;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   PRI_MIN - 1 if no thread is ready.  Interrupts must be off. */
+static int
+ready_queue_max_priority (void)
+{
+  int i;
+
+  for (i = PRI_CNT / 32 - 1; i >= 0; i--)
+    if (ready_bitmap[i] != 0)
+      return i * 32 + (31 - __builtin_clz (ready_bitmap[i]));
+  return PRI_MIN - 1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -569,6 +979,11 @@ thread_schedule_tail (struct thread *prev)
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
 
+  /* Leaving the idle thread, by whatever path, brings the timer
+     back to periodic interrupts if it was stopped. */
+  if (prev == idle_thread)
+    timer_idle_exit ();
+
   /* Start new time slice. */
   thread_ticks = 0;
 
@@ -3,8 +3,12 @@
 
 #include <debug.h>
 #include <hash.h>
+#include <heap.h>
+#include <splay.h>
 #include <list.h>
 #include <stdint.h>
+#include "devices/timer.h"
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 
 /* States in a thread's life cycle. */
@@ -26,6 +30,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the 4.4BSD scheduler. */
+#define NICE_MIN -20                    /* Most favourable niceness. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least favourable niceness. */
+
 /* Struct for holding the tids of a process' children. */
 struct child_tid
   {
@@ -83,12 +92,13 @@ struct child_tid
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in the run queue (thread.c).
+   The `waitelem' member is an element in the wait heap of a
+   semaphore or condition variable (synch.c), ordered by
+   priority; `wait_heap' points to that heap so that a change of
+   priority while blocked can reposition the thread in it.  Only
+   a thread in the ready state is on the run queue, whereas only
+   a thread in the blocked state is in a wait heap. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -96,17 +106,26 @@ struct thread
     enum thread_status status;     /* Thread state. */
     char name[16];                 /* Name (for debugging purposes). */
     uint8_t *stack;                /* Saved stack pointer. */
-    int priority;                  /* Priority. */
+    int priority;                  /* Effective priority. */
     struct list_elem allelem;      /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;         /* List element. */
-
+    int base_priority;             /* Priority before donations. */
+    struct list held_locks;        /* Locks held, for priority donation. */
+    struct lock *waiting_lock;     /* Lock being waited for, if any. */
+    struct heap_elem waitelem;     /* Wait heap element. */
+    struct heap *wait_heap;        /* Wait heap containing waitelem. */
+    unsigned wait_seq;             /* Order of arrival in wait_heap. */
+
+    /* Members for the 4.4BSD scheduler. */
+    int nice;                      /* Niceness. */
+    fixed_t recent_cpu;            /* Recent CPU time, decayed per second. */
+    unsigned mlfqs_epoch;          /* Second recent_cpu was last decayed. */
 
     /* Members for implementing alarm clock. */
-    int64_t wake_ticks;            /* The timer ticks to wake up at. */
+    struct timer sleep_timer;      /* Timer to wake up the thread. */
     struct semaphore can_wake;     /* Semaphore to put thread to sleep. */
-    struct list_elem sleepelem;    /* List element for sleep threads list. */
 
     /* Members for User Programs. */
     struct list children;          /* List of children of the process. */
@@ -118,8 +137,11 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;             /* Page directory. */
-    struct hash page_table;
+    struct page ***page_table;     /* Supplemental page table. */
+    struct splay regions;          /* Regions of the address space. */
     bool active_proc;
+    void *fault_next;              /* Page after the last fault-around. */
+    size_t fault_window;           /* Pages to map on the next fault. */
 #endif
 
     /* Owned by thread.c. */
@@ -134,7 +156,8 @@ extern bool thread_mlfqs;
 void thread_init (void);
 void thread_start (void);
 
-void thread_tick (void);
+void thread_tick (bool idle);
+bool thread_is_idle (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -149,6 +172,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -156,6 +180,8 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *, int priority);
+void thread_refresh_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -166,37 +166,26 @@ page_fault (struct intr_frame *f)
      unallowed memory access. */
   if (user || is_user_vaddr (fault_addr))
     {
+      /* A write to a page shared copy-on-write with a forked
+         process gets its own copy of the page. */
+      if (!not_present && write && page_cow_fault (fault_addr))
+        return;
       if (fault_addr > STACK_LIMIT && fault_addr > f->esp - PGSIZE
           && is_user_vaddr (fault_addr))
         {
+          /* Grow the stack with zero pages, which get a frame when
+             first written.  Only the faulting page is mapped now. */
           void *upage = pg_round_down (fault_addr);
           do
             {
-              if (!page_new_page (upage, PAGE_WRITABLE, NULL, 0, 0))
+              if (!page_new_page (upage, PAGE_WRITABLE | PAGE_ZERO))
                 goto exit;
-              struct page *p = page_get_page (upage);
-              if (p == NULL)
-                {
-                  page_remove_page (upage);
-                  goto exit;
-                }
-              void *kpage = frame_get_page (PAL_USER | PAL_ZERO, p);
-              if (kpage == NULL)
-                {
-                  page_remove_page (upage);
-                  goto exit;
-                }
-              if (!install_page (upage, kpage, true))
-                {
-                  page_remove_page (upage);
-                  frame_free_page (kpage);
-                  goto exit;
-                }
-              p->kaddr = kpage;
               upage += PGSIZE;
             }
           while (page_get_page (upage) == NULL);
-          return;
+          if (page_load_page (fault_addr, write))
+            return;
+          goto exit;
         }
       if (not_present && syscall_user_memory (fault_addr, write) != NULL)
         return;
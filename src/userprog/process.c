@@ -25,7 +25,19 @@
 #include "vm/page.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool fork_copy (struct thread *child);
+
+/* Passed by a process to the child it forks. */
+struct fork_info
+  {
+    struct intr_frame if_;      /* Where the child enters user mode. */
+    struct thread *child;       /* The child's thread. */
+    struct semaphore started;   /* Up'd by the child once it runs. */
+    struct semaphore copied;    /* Up'd by the parent once it has copied. */
+    bool success;               /* Whether the copy succeeded. */
+  };
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -180,6 +192,155 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Starts a copy of the current process, which returns from the
+   system call that F describes with 0 in eax.  Its address space
+   shares the current one's pages copy-on-write; its open files,
+   memory mappings and executable are reopened under the same
+   numbers.  The copying is done here, in the current process,
+   while the new thread waits to start.  Returns the new process's
+   thread id, or TID_ERROR on failure. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info *info;
+  bool success;
+  tid_t tid;
+
+  info = malloc (sizeof *info);
+  if (info == NULL)
+    return TID_ERROR;
+  info->if_ = *f;
+  info->if_.eax = 0;
+  sema_init (&info->started, 0);
+  sema_init (&info->copied, 0);
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork,
+                       info);
+  if (tid == TID_ERROR)
+    {
+      free (info);
+      return TID_ERROR;
+    }
+
+  /* The child frees INFO once it has been copied. */
+  sema_down (&info->started);
+  success = info->success = fork_copy (info->child);
+  sema_up (&info->copied);
+  if (!success)
+    {
+      remove_child (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that waits for its parent to copy itself into
+   it and then returns to user mode where the parent's fork system
+   call would have. */
+static void
+start_fork (void *info_)
+{
+  struct fork_info *info = info_;
+  struct intr_frame if_;
+  bool success;
+
+  info->child = thread_current ();
+  sema_up (&info->started);
+  sema_down (&info->copied);
+  if_ = info->if_;
+  success = info->success;
+  free (info);
+
+  /* If the copy failed, process_exit() frees what there is of it. */
+  if (!success)
+    thread_exit ();
+
+  process_activate ();
+  thread_current ()->active_proc = true;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Copies the current process's address space, open files, memory
+   mappings and executable into CHILD, which must not be running.
+   Returns true if successful, false otherwise, in which case the
+   child frees whatever has been copied when it exits. */
+static bool
+fork_copy (struct thread *child)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  child->pagedir = pagedir_create ();
+  if (child->pagedir == NULL || !page_fork (child))
+    return false;
+
+  /* Open files keep their fds and positions. */
+  for (e = list_begin (&cur->files); e != list_end (&cur->files);
+       e = list_next (e))
+    {
+      struct file_fd *f = list_entry (e, struct file_fd, filefdelem);
+      struct file_fd *copy = malloc (sizeof(struct file_fd));
+      if (copy == NULL)
+        return false;
+      int length = strlen (f->file_name) + 1;
+      copy->fd = f->fd;
+      copy->file_name = malloc (length * sizeof(char));
+      if (copy->file_name == NULL)
+        {
+          free (copy);
+          return false;
+        }
+      memcpy (copy->file_name, f->file_name, length);
+      lock_acquire (&file_lock);
+      copy->file = file_reopen (f->file);
+      if (copy->file != NULL)
+        file_seek (copy->file, file_tell (f->file));
+      lock_release (&file_lock);
+      if (copy->file == NULL)
+        {
+          free (copy->file_name);
+          free (copy);
+          return false;
+        }
+      list_push_back (&child->files, &copy->filefdelem);
+    }
+
+  /* Memory mappings keep their mapids.  Their regions were copied
+     with the address space. */
+  for (e = list_begin (&cur->mapids); e != list_end (&cur->mapids);
+       e = list_next (e))
+    {
+      struct memmap *m = list_entry (e, struct memmap, memmapelem);
+      struct memmap *copy = malloc (sizeof(struct memmap));
+      if (copy == NULL)
+        return false;
+      *copy = *m;
+      lock_acquire (&file_lock);
+      copy->file = file_reopen (m->file);
+      lock_release (&file_lock);
+      if (copy->file == NULL)
+        {
+          free (copy);
+          return false;
+        }
+      list_push_back (&child->mapids, &copy->memmapelem);
+    }
+
+  /* The executable stays denied writes while either process runs. */
+  if (cur->exec_file != NULL)
+    {
+      lock_acquire (&file_lock);
+      child->exec_file = file_reopen (cur->exec_file);
+      if (child->exec_file != NULL)
+        file_deny_write (child->exec_file);
+      lock_release (&file_lock);
+      if (child->exec_file == NULL)
+        return false;
+    }
+  return true;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -222,6 +383,25 @@ is_child (tid_t child_tid)
   return false;
 }
 
+/* Forgets CHILD_TID as a child of the current process, for a child
+   that failed to start. */
+void
+remove_child (tid_t child_tid)
+{
+  struct list *children = &thread_current ()->children;
+  struct list_elem *e;
+  for (e = list_begin (children); e != list_end (children); e = list_next (e))
+    {
+      struct child_tid *c = list_entry (e, struct child_tid, childtidelem);
+      if (c->tid == child_tid)
+        {
+          list_remove (e);
+          free (c);
+          break;
+        }
+    }
+}
+
 /* Free the current process's resources. */
 void
 process_exit (void)
@@ -259,7 +439,7 @@ process_exit (void)
       pre_munmap (m);
       free (m);
     }
-  page_destroy_table (&cur->page_table);
+  page_destroy_table ();
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -379,7 +559,7 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
-  if (!page_create_table (&t->page_table))
+  if (!page_create_table ())
     goto done;
   process_activate ();
 
@@ -459,31 +639,13 @@ load (const char *file_name, void (**eip) (void), void **esp)
                   zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
                 }
               lock_release (&file_lock);
-              void *page = (void *) mem_page;
               enum page_flags flags = writable ? PAGE_WRITABLE : PAGE_SHARE;
-              while (read_bytes > 0 || zero_bytes > 0)
+              if (!page_new_region ((void *) mem_page,
+                                    (read_bytes + zero_bytes) / PGSIZE,
+                                    flags, file, file_page, read_bytes))
                 {
-                  uint32_t page_read_bytes =
-                      read_bytes < PGSIZE ? read_bytes : PGSIZE;
-                  if (page_read_bytes == 0)
-                    {
-                      if (!page_new_page (page, flags | PAGE_ZERO, file_name,
-                                          file_page, 0))
-                        {
-                          lock_acquire (&file_lock);
-                          goto done;
-                        }
-                    }
-                  else if (!page_new_page (page, flags, file_name, file_page,
-                                           page_read_bytes))
-                    {
-                      lock_acquire (&file_lock);
-                      goto done;
-                    }
-                  page += PGSIZE;
-                  file_page += PGSIZE;
-                  read_bytes -= page_read_bytes;
-                  zero_bytes -= PGSIZE - page_read_bytes;
+                  lock_acquire (&file_lock);
+                  goto done;
                 }
               lock_acquire (&file_lock);
             }
@@ -609,6 +771,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           frame_free_page (kpage);
           return false; 
         }
+      frame_unpin (kpage);
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -627,7 +790,7 @@ setup_stack (void **esp)
   uint8_t *kpage;
   bool success = false;
 
-  if (!page_new_page (upage, PAGE_WRITABLE, NULL, 0, 0))
+  if (!page_new_page (upage, PAGE_WRITABLE))
     return success;
   struct page *p = page_get_page (upage);
   if (p == NULL)
@@ -640,7 +803,10 @@ setup_stack (void **esp)
     {
       success = install_page (upage, kpage, true);
       if (success)
-        *esp = PHYS_BASE;
+        {
+          frame_unpin (kpage);
+          *esp = PHYS_BASE;
+        }
       else
         {
           page_remove_page (upage);
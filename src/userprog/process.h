@@ -1,12 +1,15 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "filesys/off_t.h"
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *f);
 int process_wait (tid_t child_tid);
 bool is_child (tid_t child_tid);
+void remove_child (tid_t child_tid);
 void process_exit (void);
 void process_activate (void);
 bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
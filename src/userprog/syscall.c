@@ -1,6 +1,7 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <string.h>
+#include <round.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
@@ -194,6 +195,9 @@ syscall_handler (struct intr_frame *f)
     case SYS_MUNMAP:
       munmap (arg0);
       break;
+    case SYS_FORK:                   /* Duplicate this process. */
+      f->eax = process_fork (f);
+      break;
     }
 }
 
@@ -350,19 +354,7 @@ exec (const char *cmd_line)
       /* Frees used resources if new process cannot be created. */
       if (p_s->load_fail)
         {
-          struct list_elem *e;
-          for (e = list_begin (&t->children); e != list_end (&t->children);
-               e = list_next (e))
-            {
-              struct child_tid *c_t = list_entry (e, struct child_tid,
-                                                  childtidelem);
-              if (c_t->tid == new_tid)
-                {
-                  list_remove (e);
-                  free (c_t);
-                  break;
-                }
-            }
+          remove_child (new_tid);
           return -1;
         }
     }
@@ -617,36 +609,16 @@ mmap (int fd, void *addr)
   m->addr = addr;
   m->pages = 0;
 
-  enum page_flags flags = PAGE_WRITABLE | PAGE_SHARE;
-  bool success = true;
-  while ((m->pages + 1)* PGSIZE <= length)
-    {
-      if (!page_new_page (addr, flags, file_fd->file_name, m->pages * PGSIZE,
-                          PGSIZE))
-        {
-          success = false;
-          break;
-        }
-      m->pages++;
-      addr += PGSIZE;
-    }
-  if (!success
-      || !page_new_page (addr, flags, file_fd->file_name, m->pages * PGSIZE,
-                         length - m->pages * PGSIZE))
+  m->pages = DIV_ROUND_UP (length, PGSIZE);
+  if (!page_new_region (addr, m->pages, PAGE_WRITABLE | PAGE_SHARE, file, 0,
+                        length))
     {
-      addr -= PGSIZE;
-      while (addr >= m->addr)
-        {
-          page_remove_page (addr);
-          addr -= PGSIZE;
-        }
       lock_acquire (&file_lock);
       file_close (file);
       lock_release (&file_lock);
       free (m);
       return -1;
     }
-  m->pages++;
   list_insert_ordered (&thread_current ()->mapids, &m->memmapelem,
                        list_less_mapid, NULL);
   return m->mapid;
@@ -666,12 +638,7 @@ munmap (mapid_t mapping)
 void
 pre_munmap (struct memmap *m)
 {
-  while (m->pages > 0)
-    {
-      page_remove_page (m->addr);
-      m->pages--;
-      m->addr += PGSIZE;
-    }
+  page_remove_region (m->addr);
   lock_acquire (&file_lock);
   file_close (m->file);
   lock_release (&file_lock);
@@ -1,231 +1,706 @@
 #include "vm/frame.h"
 #include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
 #include "devices/timer.h"
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
 #include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/interrupt.h"
+#include "threads/tsc.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "filesys/file.h"
 #include "vm/swap.h"
 
-#define TAU 50 // parameter for page age (in timer ticks)
-#define VICTIM_CANDIDATES 4 // number of additional dirty pages to store on swap partition
+/* Page aging.  Every AGE_PERIOD ticks the aging thread visits the
+   next AGE_BUDGET frames on the clock, shifting each frame's age
+   right and putting the page's accessed bit in at the top.  A
+   frame whose age is 0 has not been accessed in its last 8
+   visits; among the rest, a lower age means less recent use. */
+#define AGE_PERIOD 4 // ticks between aging passes
+#define AGE_BUDGET 32 // most frames visited per aging pass
 
-static struct hash frame_table; // frame_table
+/* Eviction uses a two-handed clock.  The front hand runs
+   frame_clock_spread frames ahead of the back hand and ages each
+   frame it passes.  The back hand evicts the first frame it
+   reaches that was not accessed before that visit nor since, so
+   a frame has at least the time the hands take to cover the
+   spread to show that it is in use.  A single eviction moves the
+   hands over at most SCAN_BUDGET frames: if none of them is cold,
+   the least recently used one is evicted. */
+#define SCAN_BUDGET 64 // most frames passed per eviction
+size_t frame_clock_spread = 64; // distance between the hands
+
+/* The frame table has one descriptor for every page in the user
+   pool, indexed by frame number, so that looking up the frame for
+   a kernel address is arithmetic.  A descriptor is in use while
+   its page member is non-null.  The clock hands are indexes into
+   the table and sweep it in order. */
+static struct frame *frames; // frame_table
+static size_t frame_cnt; // Number of entries in frame_table
+static uint8_t *user_base; // Kernel address of frame 0
 static struct lock frame_lock; // Lock to synchronise frame_table changes
-static struct list clock; // Clock-list used for eviction algorithm
-static struct lock clock_lock; // Lock to synchronise clock changes
-static struct list_elem *hand; // list_elem pointing to an element of the clock
+static struct condition frame_cond; // Signalled when a frame stops being evicted or cleaned
+static size_t hand; // Index of the frame the back hand points to
+static size_t age_hand; // Index of the next frame for the aging thread to visit
+
+/* Free-frame watermarks.  When an allocation leaves fewer than
+   free_low frames free, the reclaim thread is woken to evict
+   frames until free_high are free, so that page faults seldom
+   have to evict a frame themselves. */
+static size_t free_cnt; // Number of free frames
+static size_t free_low; // Wake the reclaim thread below this
+static size_t free_high; // Reclaim thread stops at this
+static struct semaphore reclaim_sema; // Up'd to wake the reclaim thread
+static bool reclaim_pending; // reclaim_sema up'd but not yet handled
+
+/* Page-out.  When an allocation leaves fewer than free_clean
+   frames free, the pageout thread is woken to write dirty frames
+   that have not been accessed lately to swap, or to their file
+   for mmapped pages, PAGEOUT_BATCH frames at a time, and mark
+   them clean.  Evicting a clean frame needs no disk I/O: a page
+   with a copy in swap has PAGE_SWAP set even while resident, and
+   keeps the copy until it is dirtied again. */
+#define PAGEOUT_BATCH 16 // most frames cleaned per batch
+static size_t free_clean; // Wake the pageout thread below this
+static size_t pageout_hand; // Index of the next frame to consider cleaning
+static struct semaphore pageout_sema; // Up'd to wake the pageout thread
+static bool pageout_pending; // pageout_sema up'd but not yet handled
 
+/* Statistics */
+static long long evict_cnt; // Frames evicted
+static long long direct_evict_cnt; // Of those, evicted by frame_get_page()
+static long long scan_cnt; // Frames passed by the back hand
+static size_t scan_max; // Most frames passed in one eviction
+static uint64_t evict_cycles; // CPU cycles spent evicting
+static uint64_t evict_cycles_max; // Most cycles spent on one eviction
+static long long clean_cnt; // Frames cleaned by the pageout thread
+static long long stalls_avoided; // Dirty pages evicted without a write
 
-static unsigned frame_hash (const struct hash_elem *e, void *aux UNUSED);
-static bool frame_less (const struct hash_elem *a, const struct hash_elem *b,
-                        void *aux UNUSED);
-static struct hash_elem *frame_lookup (void *kaddr);
+static struct frame *frame_lookup (void *kaddr);
+static void frame_age (struct frame *f);
+static bool frame_accessed (struct frame *f);
+static void frame_age_thread (void *aux UNUSED);
+static void frame_age_pass (void);
+static void frame_reclaim_thread (void *aux UNUSED);
+static struct frame *frame_choose_victim (size_t *scanned);
+static bool frame_evict (bool direct);
+static void frame_pageout_thread (void *aux UNUSED);
+static int frame_pageout_batch (void);
+static bool frame_is_mmap (const struct page *p);
+static bool frame_mapped_by (struct frame *f, struct page *p);
 
 /* Initialises the global static variables */
 void
 frame_init (void)
 {
-  hash_init (&frame_table, frame_hash, frame_less, NULL);
-  list_init (&clock);
-  hand = list_begin(&clock);
+  user_base = palloc_user_pool (&frame_cnt);
+  frames = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                DIV_ROUND_UP (frame_cnt * sizeof *frames,
+                                              PGSIZE));
+  size_t i;
+  for (i = 0; i < frame_cnt; i++)
+    frames[i].kaddr = user_base + i * PGSIZE;
+  hand = 0;
+  age_hand = 0;
   lock_init (&frame_lock);
-  lock_init (&clock_lock);
+  cond_init (&frame_cond);
+
+  free_cnt = frame_cnt;
+  if (frame_cnt >= 64)
+    {
+      free_low = frame_cnt / 32;
+      free_high = frame_cnt / 16;
+      free_clean = frame_cnt / 8;
+    }
+  sema_init (&reclaim_sema, 0);
+  sema_init (&pageout_sema, 0);
 }
 
-/* Ensures a free frame, either by swapping out a page or by
- * calling palloc_get_page */
-void *
-frame_get_page (enum palloc_flags flags, struct page *current_page)
+/* Starts the aging, reclaim and pageout threads.  Must be called
+   after thread_start() */
+void
+frame_start (void)
 {
-  ASSERT(flags & PAL_USER);
+  thread_create ("aging", PRI_MAX, frame_age_thread, NULL);
+  thread_create ("reclaim", PRI_MAX, frame_reclaim_thread, NULL);
+  thread_create ("pageout", PRI_MAX, frame_pageout_thread, NULL);
+}
+
+/* Ages frame F, which must be in use: shifts its age right and
+   moves in at the top whether any page mapping it has been
+   accessed, clearing their accessed bits.  Caller needs to hold
+   frame_lock */
+static void
+frame_age (struct frame *f)
+{
+  bool accessed = false;
+  struct page *p;
+
+  for (p = f->page; p != NULL; p = p->frame_next)
+    if (pagedir_is_accessed (p->pd, p->uaddr))
+      {
+        pagedir_set_accessed (p->pd, p->uaddr, false);
+        accessed = true;
+      }
+  f->age = (f->age >> 1) | (accessed ? 0x80 : 0);
+}
+
+/* Returns true if any page mapping frame f has been accessed since
+   f was last aged.  Caller needs to hold frame_lock */
+static bool
+frame_accessed (struct frame *f)
+{
+  struct page *p;
+
+  for (p = f->page; p != NULL; p = p->frame_next)
+    if (pagedir_is_accessed (p->pd, p->uaddr))
+      return true;
+  return false;
+}
 
-  void *page = palloc_get_page (flags);
-  // If there is no free frame:
-  if (page == NULL)
+/* Aging thread: runs an aging pass every AGE_PERIOD ticks */
+static void
+frame_age_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (AGE_PERIOD);
+      frame_age_pass ();
+    }
+}
+
+/* Visits the next AGE_BUDGET entries of the frame table,
+   continuing from where the last pass stopped, and ages each
+   resident frame among them */
+static void
+frame_age_pass (void)
+{
+  int budget = AGE_BUDGET;
+
+  if (frame_cnt == 0)
+    return;
+
+  lock_acquire (&frame_lock);
+  while (budget-- > 0)
     {
-      // Swap algorithm: WSClock
-
-      // Set up locals
-      struct frame *victim = NULL;
-      struct frame *candidate_victims[VICTIM_CANDIDATES];
-      int num_candidate = 0;
-      int64_t age = 0;
-      struct list_elem *first_elem = hand;
-      bool dirty;
-      page_swapping:
-      // If the hand points to the lists tail, start over from beginning of list
-      if (hand == list_tail (&clock))
-        hand = list_begin (&clock);
-      // acquire frame that "hand" points to
-      struct frame *e = list_entry(hand, struct frame, framelistelem);
-      // get this frame's page's page_directory
-      struct page *e_page = e->page;
-      ASSERT(e->page->pd !=NULL);
-      //      printf("frame_get_page: %s\n", e_page->file_name);
-      if (!e_page->pinned)
+      struct frame *f = &frames[age_hand];
+      if (f->page != NULL)
+        frame_age (f);
+      age_hand = (age_hand + 1) % frame_cnt;
+    }
+  lock_release (&frame_lock);
+}
+
+/* Reclaim thread: whenever it is woken, evicts frames until
+   free_high frames are free or a full turn of the clock finds
+   nothing to evict */
+static void
+frame_reclaim_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      size_t failures = 0;
+
+      sema_down (&reclaim_sema);
+      while (free_cnt < free_high && failures * SCAN_BUDGET < frame_cnt)
         {
-          void *e_uaddr = e_page->uaddr;
-          // find the age of last access for this page
-          int64_t page_age = timer_elapsed (e_page->last_accessed_time);
-          if (page_age > TAU)
-            {
-              // If it's older than the parameter TAU,
-              // update local variables to store best victim yet
-              age = page_age;
-              victim = e;
-              //	      ASSERT (e_page->pd !=NULL);
-              if (!pagedir_is_dirty (e_page->pd, e_uaddr))
-                {
-                  // If the page is clean, choose this page and perform swap
-                  goto do_swap;
-                }
-              //if the page is dirty,
-              if (e->page->flags & PAGE_SWAP)
-                {
-                  // If we swapped out the page as a candidate, free the swap slot and clear the flag
-                  swap_free (e->page);
-                  e->page->flags &= !PAGE_SWAP;
-                }
-              if (num_candidate < VICTIM_CANDIDATES)
-                {
-                  // and if there is space for extra victims to be swapped,
-                  // add the page to the candidate_victims array
-                  candidate_victims[num_candidate] = e;
-                  num_candidate++;
-                }
-            }
+          if (frame_evict (false))
+            failures = 0;
           else
-            {
-              // if the page is not older than TAU,
-              if (page_age > age)
-                {
-                  // but is the oldest page yet,
-                  // update locals
-                  age = page_age;
-                  victim = e;
-                }
-            }
+            failures++;
         }
-      // Move hand up one entry
-      hand = list_next (hand);
-      // If the clock is fully traversed, do the swap, otherwise restart algorithm
-      if (hand != first_elem)
-        goto page_swapping;
-
-      do_swap:
-      // If the page is clean, it doesn't have to be copied, so just return true
-      dirty = pagedir_is_dirty (victim->page->pd, victim->page->uaddr);
-      // Remove mapping in pagedir
-      pagedir_clear_page (victim->page->pd, victim->page->uaddr);
-      if (dirty)
+      lock_acquire (&frame_lock);
+      reclaim_pending = false;
+      lock_release (&frame_lock);
+    }
+}
+
+/* Advances the clock hands by up to SCAN_BUDGET frames and returns
+   the frame to evict, marked as being evicted, or NULL if all the
+   frames passed are free, pinned, or already being evicted or
+   cleaned.  Frames shared copy-on-write or held in the page cache
+   are evicted like any other, from every page that maps them.
+   Stores the number of frames passed in *SCANNED.  Caller needs to
+   hold frame_lock */
+static struct frame *
+frame_choose_victim (size_t *scanned)
+{
+  struct frame *victim = NULL;
+  size_t spread = frame_clock_spread < frame_cnt
+                  ? frame_clock_spread : frame_cnt - 1;
+  size_t n = 0;
+
+  while (n < SCAN_BUDGET)
+    {
+      struct frame *front = &frames[(hand + spread) % frame_cnt];
+      struct frame *back = &frames[hand];
+      hand = (hand + 1) % frame_cnt;
+      n++;
+
+      if (front->page != NULL)
+        frame_age (front);
+      if (back->page == NULL || back->evicting || back->cleaning
+          || back->pin_cnt > 0)
+        continue;
+      if (!(back->age & 0x80) && !frame_accessed (back))
         {
-          // Perform the swap of the victim
-          ASSERT(victim->page !=NULL);
-          swap_out (victim->page);
+          // Not accessed since before the front hand's visit: evict it
+          victim = back;
+          break;
         }
-      // victim->page->flags |= PAGE_SWAP;
-      // if victim in candidate_victim[] this means it will do nothing
-      // free the page inside the frame
-      frame_free_page (victim->kaddr);
-      // get new page using palloc_get_page
-      page = palloc_get_page (flags);
-      // release lock after the this so new page can be read in into victim
-      int n;
-      for (n = 0; n < num_candidate; n++)
+      if (victim == NULL || back->age < victim->age)
+        victim = back;
+    }
+
+  *scanned = n;
+  if (victim != NULL)
+    victim->evicting = true;
+  return victim;
+}
+
+/* Evicts one frame, writing its page to swap if it is dirty or has
+   no file to be reloaded from, or back to its file if it is an
+   mmapped page.  A frame shared copy-on-write is written to swap
+   once, for all the pages that need a copy.  DIRECT says whether a
+   page fault is waiting for the frame.  Returns false if no frame
+   could be chosen */
+static bool
+frame_evict (bool direct)
+{
+  uint64_t start = rdtsc ();
+  struct frame *victim;
+  struct page *p;
+  size_t scanned;
+  uint64_t cycles;
+
+  if (frame_cnt == 0)
+    return false;
+
+  lock_acquire (&frame_lock);
+  victim = frame_choose_victim (&scanned);
+  scan_cnt += scanned;
+  if (scanned > scan_max)
+    scan_max = scanned;
+  p = victim != NULL ? victim->page : NULL;
+  lock_release (&frame_lock);
+  if (victim == NULL)
+    return false;
+
+  if (p->flags & PAGE_FRAME)
+    page_cache_evict (p);
+  else
+    {
+      // Remove every mapping in pagedirs, then save the pages if
+      // necessary.  The pages are no longer shared, so they come back
+      // private.  Clearing the mappings first keeps a write from
+      // slipping in after the dirty bits are read
+      struct page *q, *copy = NULL;
+      for (q = p; q != NULL; q = q->frame_next)
+        pagedir_clear_page (q->pd, q->uaddr);
+      if (frame_is_mmap (p))
         {
-          // swap all the candidates out as well
-          struct frame *candidate_victim = candidate_victims[n];
-          if (candidate_victim != NULL)
+          // Only private pages are shared copy-on-write
+          p->flags &= ~PAGE_COW;
+          if (pagedir_is_dirty (p->pd, p->uaddr))
             {
-              ASSERT(candidate_victim->page !=NULL);
-              swap_out (candidate_victim->page);
-              pagedir_set_dirty (candidate_victim->page->pd,
-                                 candidate_victim->page->uaddr, false);
+              bool held = lock_held_by_current_thread (&file_lock);
+              if (!held)
+                lock_acquire (&file_lock);
+              file_write_at (page_file (p), victim->kaddr,
+                             page_read_bytes (p), page_file_ofs (p));
+              if (!held)
+                lock_release (&file_lock);
             }
         }
+      else
+        for (q = p; q != NULL; q = q->frame_next)
+          {
+            bool dirty = pagedir_is_dirty (q->pd, q->uaddr);
+            q->flags &= ~PAGE_COW;
+            if (dirty)
+              swap_free (q); // Any copy in swap is out of date
+            if (dirty || (page_file (q) == NULL && !(q->flags & PAGE_SWAP)))
+              {
+                if (p->frame_next == NULL)
+                  swap_out (q);
+                else
+                  {
+                    swap_out_shared (q, copy);
+                    if (copy == NULL)
+                      copy = q;
+                  }
+              }
+            else if (q->flags & PAGE_SWAP)
+              stalls_avoided++;
+          }
+    }
+  frame_free_page (victim->kaddr);
+
+  cycles = rdtsc () - start;
+  lock_acquire (&frame_lock);
+  evict_cnt++;
+  if (direct)
+    direct_evict_cnt++;
+  evict_cycles += cycles;
+  if (cycles > evict_cycles_max)
+    evict_cycles_max = cycles;
+  lock_release (&frame_lock);
+  return true;
+}
+
+/* Pageout thread: whenever it is woken, cleans batches of frames
+   until enough frames are free or there is nothing left to
+   clean */
+static void
+frame_pageout_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&pageout_sema);
+      while (frame_pageout_batch () == PAGEOUT_BATCH
+             && free_cnt < free_clean)
+        continue;
+      lock_acquire (&frame_lock);
+      pageout_pending = false;
+      lock_release (&frame_lock);
+    }
+}
+
+/* Returns true if P is a page of a memory-mapped file, which is
+   written back to its file rather than to swap */
+static bool
+frame_is_mmap (const struct page *p)
+{
+  return (p->flags & (PAGE_SHARE | PAGE_WRITABLE))
+         == (PAGE_SHARE | PAGE_WRITABLE);
+}
+
+/* Writes up to PAGEOUT_BATCH dirty frames that were not accessed
+   before their last aging visit to swap or to their file, and
+   marks them clean, looking at each frame at most once.  Returns
+   the number of frames cleaned */
+static int
+frame_pageout_batch (void)
+{
+  int cleaned = 0;
+  size_t n;
+
+  for (n = 0; n < frame_cnt && cleaned < PAGEOUT_BATCH; n++)
+    {
+      lock_acquire (&frame_lock);
+      struct frame *f = &frames[pageout_hand];
+      struct page *p = f->page;
+      pageout_hand = (pageout_hand + 1) % frame_cnt;
+      if (p == NULL || f->evicting || f->cleaning || (f->age & 0x80)
+          || f->refs > 1 || f->pin_cnt > 0
+          || ((p->flags & PAGE_SHARE) && !frame_is_mmap (p))
+          || !pagedir_is_dirty (f->pd, f->uaddr))
+        {
+          lock_release (&frame_lock);
+          continue;
+        }
+      f->cleaning = true;
+      lock_release (&frame_lock);
+
+      // Clear the dirty bit before copying, so that a write during
+      // the copy leaves the page dirty
+      pagedir_set_dirty (f->pd, f->uaddr, false);
+      if (frame_is_mmap (p))
+        {
+          lock_acquire (&file_lock);
+          file_write_at (page_file (p), f->kaddr, page_read_bytes (p),
+                         page_file_ofs (p));
+          lock_release (&file_lock);
+        }
+      else
+        {
+          swap_free (p);
+          swap_out (p);
+        }
 
+      lock_acquire (&frame_lock);
+      f->cleaning = false;
+      clean_cnt++;
+      cond_broadcast (&frame_cond, &frame_lock);
+      lock_release (&frame_lock);
+      cleaned++;
+    }
+  return cleaned;
+}
+
+/* Returns a free frame for CURRENT_PAGE, evicting a page if
+   there is none.  The frame comes back pinned, since it is not
+   mapped yet and so would look unused to the clock: the caller
+   unpins it once it has filled and mapped it.  Wakes the reclaim
+   and pageout threads if free frames are running low */
+void *
+frame_get_page (enum palloc_flags flags, struct page *current_page)
+{
+  void *page;
+  size_t failures = 0;
 
+  ASSERT(flags & PAL_USER);
 
+  // If there is no free frame, evict one and try again
+  while ((page = palloc_get_page (flags)) == NULL)
+    {
+      if (frame_evict (true))
+        failures = 0;
+      else if (++failures * SCAN_BUDGET >= 2 * frame_cnt)
+        PANIC ("frame_get_page: no frame to evict");
+      else
+        thread_yield ();
     }
+
   // Set up the frame
-  struct frame *f = malloc (sizeof(struct frame));
-  if (f == NULL)
-    PANIC("frame_get_multiple: out of memory");
-  f->kaddr = page;
-  f->page = current_page;
-  // insert frame into frame_table
+  struct frame *f = frame_lookup (page);
   lock_acquire (&frame_lock);
-  hash_insert (&frame_table, &f->framehashelem);
+  f->page = current_page;
+  f->pd = current_page->pd;
+  f->uaddr = current_page->uaddr;
+  f->age = 0x80; // count the fault that brought the page in as an access
+  f->evicting = false;
+  f->cleaning = false;
+  f->refs = 1;
+  f->pin_cnt = 1;
+  free_cnt--;
+  if (free_cnt < free_low && !reclaim_pending)
+    {
+      reclaim_pending = true;
+      sema_up (&reclaim_sema);
+    }
+  if (free_cnt < free_clean && !pageout_pending)
+    {
+      pageout_pending = true;
+      sema_up (&pageout_sema);
+    }
   lock_release (&frame_lock);
-
-  // insert frame into clock
-  lock_acquire (&clock_lock);
-  list_push_back (&clock, &f->framelistelem);
-  lock_release (&clock_lock);
-  ASSERT (page !=NULL);
   return page;
 }
 
-/* Frees frame entry and corresponding page */
+/* Returns true if so few frames are free that speculative loads,
+   such as fault-around, should be skipped */
+bool
+frame_scarce (void)
+{
+  return free_cnt < free_clean;
+}
+
+/* Frees frame entry and corresponding page, once the pageout
+   thread has finished with it.  Any pages still on the frame's
+   chain, which an eviction has unmapped, are unlinked from it */
 void
 frame_free_page (void *page)
 {
-  // Remove frame from frame_table
+  struct frame *f = frame_lookup (page);
+
   lock_acquire (&frame_lock);
-  struct hash_elem *he = hash_delete (&frame_table, frame_lookup (page));
+  while (f->cleaning)
+    cond_wait (&frame_cond, &frame_lock);
+  while (f->page != NULL)
+    {
+      struct page *next = f->page->frame_next;
+      f->page->frame_next = NULL;
+      f->page = next;
+    }
+  f->evicting = false;
+  f->refs = 0;
+  free_cnt++;
+  cond_broadcast (&frame_cond, &frame_lock);
   lock_release (&frame_lock);
 
-  struct frame *entry = hash_entry (he, struct frame, framehashelem);
-
-  // Remove frame from clock
-  lock_acquire (&clock_lock);
-  list_remove (&entry->framelistelem);
-  lock_release (&clock_lock);
-
-  // free frame
-    free (entry);
   // free page
   palloc_free_page (page);
 }
 
-/* Hash helper for the swap_table hash_table */
-static unsigned
-frame_hash (const struct hash_elem *e, void *aux UNUSED)
+/* Returns true if page p is on the chain of pages mapping frame f.
+   Caller needs to hold frame_lock */
+static bool
+frame_mapped_by (struct frame *f, struct page *p)
 {
-  const struct frame *f = hash_entry (e, struct frame, framehashelem);
-  return hash_bytes (&f->kaddr, sizeof f->kaddr);
+  struct page *q;
+  for (q = f->page; q != NULL; q = q->frame_next)
+    if (q == p)
+      return true;
+  return false;
 }
 
-/* Hash helper for the swap_table hash_table */
-static bool
-frame_less (const struct hash_elem *a, const struct hash_elem *b,
-            void *aux UNUSED)
+/* Makes page p share the frame at kaddr with owner, which maps it,
+   or, if owner is NULL, with the pages already mapping it: p joins
+   the frame's chain.  Fails if owner no longer maps the frame or it
+   is free or being evicted or cleaned */
+bool
+frame_share (void *kaddr, struct page *owner, struct page *p)
+{
+  struct frame *f = frame_lookup (kaddr);
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  if (f->page != NULL && !f->evicting && !f->cleaning
+      && (owner == NULL || frame_mapped_by (f, owner)))
+    {
+      p->frame_next = f->page->frame_next;
+      f->page->frame_next = p;
+      f->refs++;
+      success = true;
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Pins the frame at kaddr, which page p maps, so that it is neither
+   evicted nor cleaned while p takes a copy of it.  Fails if the
+   frame is being evicted or cleaned */
+bool
+frame_pin (void *kaddr, struct page *p)
+{
+  struct frame *f = frame_lookup (kaddr);
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  if (!f->evicting && !f->cleaning && frame_mapped_by (f, p))
+    {
+      f->pin_cnt++;
+      success = true;
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Unpins the frame at kaddr */
+void
+frame_unpin (void *kaddr)
 {
-  return hash_entry (a, struct frame, framehashelem)->kaddr <
-      hash_entry (b, struct frame, framehashelem)->kaddr;
+  struct frame *f = frame_lookup (kaddr);
+
+  lock_acquire (&frame_lock);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Returns the number of pages that map the frame at kaddr */
+int
+frame_refs (void *kaddr)
+{
+  struct frame *f = frame_lookup (kaddr);
+  int refs;
+
+  lock_acquire (&frame_lock);
+  refs = f->refs;
+  lock_release (&frame_lock);
+  return refs;
 }
 
-/* Returns the hash_elem corresponding to the given virtual kernel address */
-static struct hash_elem *
+/* Removes page p, which has pinned the frame at kaddr, from the
+   pages that map it, and unpins it.  Returns true if no page maps
+   the frame any more, in which case the caller frees it */
+bool
+frame_unshare (void *kaddr, struct page *p)
+{
+  struct frame *f = frame_lookup (kaddr);
+  struct page **q;
+  bool last;
+
+  lock_acquire (&frame_lock);
+  for (q = &f->page; *q != NULL; q = &(*q)->frame_next)
+    if (*q == p)
+      {
+        *q = p->frame_next;
+        f->refs--;
+        break;
+      }
+  p->frame_next = NULL;
+  f->pin_cnt--;
+  if (f->page != NULL)
+    {
+      // The aging thread follows the new head of the chain
+      f->pd = f->page->pd;
+      f->uaddr = f->page->uaddr;
+    }
+  last = f->refs == 0;
+  lock_release (&frame_lock);
+  return last;
+}
+
+/* Unmaps page p, which is being destroyed, from the frame it maps,
+   if any, and frees the frame unless another page still maps it.
+   If the frame is being evicted or cleaned, waits for the eviction
+   or the pageout thread to finish with p and its page directory
+   first */
+void
+frame_detach (struct page *p)
+{
+  size_t idx = pg_no (p->kaddr) - pg_no (user_base);
+  struct frame *f;
+  struct page **q;
+  bool last = false;
+
+  if (p->kaddr == NULL || idx >= frame_cnt)
+    return;
+  f = &frames[idx];
+
+  lock_acquire (&frame_lock);
+  while ((f->evicting || f->cleaning) && frame_mapped_by (f, p))
+    cond_wait (&frame_cond, &frame_lock);
+  // p->kaddr is left behind when p is evicted, so p may not be on
+  // the chain of the frame any more
+  for (q = &f->page; *q != NULL; q = &(*q)->frame_next)
+    if (*q == p)
+      {
+        *q = p->frame_next;
+        p->frame_next = NULL;
+        pagedir_clear_page (p->pd, p->uaddr);
+        last = --f->refs == 0;
+        if (!last)
+          {
+            f->pd = f->page->pd;
+            f->uaddr = f->page->uaddr;
+          }
+        break;
+      }
+  lock_release (&frame_lock);
+  if (last)
+    frame_free_page (f->kaddr);
+}
+
+/* Returns the frame_table entry for the given virtual kernel
+   address, which must be in the user pool */
+static struct frame *
 frame_lookup (void *kaddr)
 {
-  //Caller needs to hold frame_lock already
-  struct frame f;
-  struct hash_elem *e;
-  f.kaddr = kaddr;
-  e = hash_find (&frame_table, &f.framehashelem);
-  return e;
+  size_t idx = pg_no (kaddr) - pg_no (user_base);
+  ASSERT (idx < frame_cnt);
+  return &frames[idx];
 }
 
+/* Returns the frame holding the given virtual kernel address, or
+   NULL if it is not a user frame in use */
 struct frame *
 frame_get_frame (void *kaddr)
 {
-  struct hash_elem *e = frame_lookup (kaddr);
-  if (e == NULL)
+  size_t idx = pg_no (kaddr) - pg_no (user_base);
+  if (idx >= frame_cnt || frames[idx].page == NULL)
     return NULL;
-  return hash_entry(e, struct frame, framehashelem);
+  return &frames[idx];
+}
+
+/* Prints frame table statistics */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %lld evictions (%lld by page faults), "
+          "%lld frames scanned, %zu most in one eviction\n",
+          evict_cnt, direct_evict_cnt, scan_cnt, scan_max);
+  if (evict_cnt > 0)
+    printf ("Frames: eviction took %"PRIu64" cycles on average, "
+            "%"PRIu64" at most\n",
+            evict_cycles / evict_cnt, evict_cycles_max);
+  printf ("Pageout: %lld pages cleaned (%lld per second), "
+          "%lld eviction writes avoided\n",
+          clean_cnt, clean_cnt * TIMER_FREQ / (timer_ticks () + 1),
+          stalls_avoided);
 }
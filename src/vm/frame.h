@@ -2,23 +2,43 @@
 #define VM_FRAME_H
 
 #include <stddef.h>
-#include <hash.h>
+#include <stdint.h>
 #include "threads/palloc.h"
 #include "vm/page.h"
 
-/* frame_table entries contain the virtual kernel address and the page_directory */
+/* frame_table entries contain the virtual kernel address and the page
+   that occupies the frame, or NULL if the frame is free.  A frame
+   shared copy-on-write by forked processes, or held in the page
+   cache, is mapped by every page on the chain that starts at page
+   and continues through frame_next */
 struct frame
 {
-  struct hash_elem framehashelem;
-  struct list_elem framelistelem;
   void *kaddr;
   struct page *page;
+  uint32_t *pd;         /* Page directory and user address the frame */
+  void *uaddr;          /* is mapped at, for the aging thread. */
+  uint8_t age;          /* Accessed bits of the last 8 aging visits. */
+  bool evicting;        /* Being evicted? */
+  bool cleaning;        /* Being written out by the pageout thread? */
+  int refs;             /* Pages mapping the frame. */
+  int pin_cnt;          /* Copies of the frame in progress. */
 };
 
+extern size_t frame_clock_spread;
+
 void frame_init (void);
+void frame_start (void);
 void *frame_get_page (enum palloc_flags flags, struct page *current_page);
+bool frame_scarce (void);
 void frame_free_page (void *page);
+bool frame_share (void *kaddr, struct page *owner, struct page *p);
+bool frame_pin (void *kaddr, struct page *p);
+void frame_unpin (void *kaddr);
+int frame_refs (void *kaddr);
+bool frame_unshare (void *kaddr, struct page *p);
+void frame_detach (struct page *p);
 void frame_free_multiple (void *pages, size_t page_cnt);
 struct frame *frame_get_frame (void *kaddr);
+void frame_print_stats (void);
 
 #endif /* vm_frame_h */
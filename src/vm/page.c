@@ -1,8 +1,10 @@
 #include "vm/page.h"
 #include <debug.h>
+#include <stdio.h>
 #include <string.h>
-#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
@@ -10,167 +12,311 @@
 #include "vm/swap.h"
 #include "userprog/syscall.h"
 #include "filesys/file.h"
-#include "filesys/filesys.h"
+#include "filesys/inode.h"
 
-/* A struct for a shared page */
-struct shared
+/* An entry in the page cache: the frame holding page index of
+   inode, which every page of a shared region backed by that page of
+   the inode maps.  The pages are those on the frame's chain, see
+   frame.h.  The entry goes when the last of them unmaps the frame or
+   it is evicted */
+struct cached_page
   {
-    struct hash_elem sharedhashelem;
+    struct hash_elem cachehashelem;
+    struct inode *inode;        // Reopened for as long as the entry lives
+    size_t index;               // Page index within the inode
     void *kaddr;
-    char *file_name;
-    struct file *file;
-    off_t ofs;
-    uint32_t read_bytes;
-    bool dirty;
-    int share_count;
+    uint32_t write_bytes;       // Bytes written back if dirty, 0 if read-only
+    bool dirty;                 // Dirtied through a page that has unmapped it
   };
 
-/* hash_table for all shared pages */
-static struct hash shared_pages;
-/* Lock to synchronise access to shared_pages */
-static struct lock shared_lock;
+/* Most pages mapped ahead of a file-backed fault */
+size_t page_fault_around = 16;
+
+/* A page of zeros, mapped read-only for reads of private zero pages
+   until they are first written */
+static void *zero_kaddr;
+
+/* The page cache, keyed by inode and page index */
+static struct hash page_cache;
+/* Lock to synchronise access to page_cache and to the chains of
+   cached frames */
+static struct lock cache_lock;
+
+/* Statistics */
+static long long cache_hit_cnt; // Faults mapped to a cached frame
+static long long cache_miss_cnt; // Faults on shared pages not in the cache
+static long long cache_evict_cnt; // Cached frames evicted
+static long long zero_map_cnt; // Read faults given the zero page
+static long long zero_copy_cnt; // Of those, later written
 
 static bool page_load_shared (struct page *p);
 static void page_unload_shared (struct page *p);
-static bool page_add_shared (struct page *p);
-
-static void page_destroy (struct hash_elem *e, void *aux UNUSED);
-static unsigned page_hash (const struct hash_elem *e, void *aux UNUSED);
-static bool page_less (const struct hash_elem *a, const struct hash_elem *b,
-                       void *aux UNUSED);
-static struct hash_elem *page_lookup (const void *uaddr);
-static unsigned page_shared_hash (const struct hash_elem *e,
-                                  void *aux UNUSED);
-static bool page_shared_less (const struct hash_elem *a,
-                              const struct hash_elem *b,
-                              void *aux UNUSED);
-static struct hash_elem *page_shared_lookup (const char *file_name,
-                                             off_t ofs);
+static void page_add_shared (struct page *p);
+static void page_cache_drop (struct cached_page *c);
+static bool page_load_file (struct page *p);
+static void page_map_around (struct page *p);
+static struct page *page_from_region (struct region *r, void *uaddr);
+static bool page_fork_page (struct thread *child, struct page *p);
+
+static void page_destroy (struct page *p);
+static struct page **page_lookup (const void *uaddr, bool create);
+static struct page **page_slot (struct page ***dir, const void *uaddr,
+                                bool create);
+static void page_remove_range (uint8_t *start, uint8_t *end);
+static unsigned page_cache_hash (const struct hash_elem *e,
+                                 void *aux UNUSED);
+static bool page_cache_less (const struct hash_elem *a,
+                             const struct hash_elem *b, void *aux UNUSED);
+static struct cached_page *page_cache_lookup (const struct page *p);
+static bool region_less (const struct splay_elem *a,
+                         const struct splay_elem *b, void *aux UNUSED);
+static struct region *region_lookup (const void *uaddr);
+static struct region *region_find (struct splay *regions, const void *uaddr);
+static struct region *region_create (void *start, void *end,
+                                     enum page_flags flags,
+                                     struct file *file, off_t ofs,
+                                     uint32_t read_bytes);
+static void region_destroy (struct region *r);
 
 /* Initialises global static variables */
 void
 page_init (void)
 {
-  ASSERT (
-      hash_init (&shared_pages, page_shared_hash, page_shared_less, NULL));
-  lock_init (&shared_lock);
+  ASSERT (hash_init (&page_cache, page_cache_hash, page_cache_less, NULL));
+  lock_init (&cache_lock);
+  zero_kaddr = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 }
 
-/* Destroys the shared_pages hash_table */
+/* Destroys the page_cache hash_table */
 void
 page_done (void)
 {
-  hash_destroy (&shared_pages, NULL);
+  hash_destroy (&page_cache, NULL);
+}
+
+/* Prints page cache statistics */
+void
+page_print_stats (void)
+{
+  printf ("Page cache: %lld hits, %lld misses, %lld evictions\n",
+          cache_hit_cnt, cache_miss_cnt, cache_evict_cnt);
+  printf ("Zero page: %lld read faults mapped, %lld written since\n",
+          zero_map_cnt, zero_copy_cnt);
 }
 
-/* Initialises the hash_table page_table */
+/* Creates the current thread's page_table and regions.  The
+   page_table is a two-level radix tree laid out like the page
+   directory: a directory page indexed by pd_no() of a user
+   address points to table pages, allocated on first use, that are
+   indexed by pt_no() and hold pointers to pages */
 bool
-page_create_table (struct hash *page_table)
+page_create_table (void)
 {
-  return hash_init (page_table, page_hash, page_less, NULL);
+  struct thread *t = thread_current ();
+  splay_init (&t->regions, region_less, NULL);
+  t->page_table = palloc_get_page (PAL_ZERO);
+  return t->page_table != NULL;
 }
 
-/* Destroys the page_table hash_table */
+/* Destroys the current thread's page_table, with all its pages,
+   and its regions */
 void
-page_destroy_table (struct hash *page_table)
+page_destroy_table (void)
 {
-  hash_destroy (page_table, page_destroy);
+  struct thread *t = thread_current ();
+  struct splay *regions = &t->regions;
+  size_t i;
+
+  if (t->page_table == NULL)
+    return;
+  page_remove_range (0, PHYS_BASE);
+  for (i = 0; i < pd_no (PHYS_BASE); i++)
+    palloc_free_page (t->page_table[i]);
+  palloc_free_page (t->page_table);
+  t->page_table = NULL;
+  while (!splay_empty (regions))
+    {
+      struct region *r = splay_entry (splay_first (regions), struct region,
+                                      regionelem);
+      splay_remove (regions, &r->regionelem);
+      region_destroy (r);
+    }
 }
 
-/* Removes page from hash_table and frees it */
+/* Frees page p, which has been removed from the page_table */
 static void
-page_destroy (struct hash_elem *e, void *aux UNUSED)
+page_destroy (struct page *p)
 {
-  struct page *p = hash_entry (e, struct page, pagehashelem);
+  // The zero page is never freed
+  if ((p->flags & PAGE_COW)
+      && pagedir_get_page (p->pd, p->uaddr) == zero_kaddr)
+    pagedir_clear_page (p->pd, p->uaddr);
   page_unload_shared (p);
-  lock_acquire (&file_lock);
-  file_close (p->file);
-  lock_release (&file_lock);
-  free (p->file_name);
+  // Any other frame is let go of before p is freed, so that neither
+  // an eviction in progress nor pagedir_destroy() uses p or the
+  // frame afterwards.  A frame shared with a forked process is freed
+  // by the last page to let go of it
+  frame_detach (p);
+  swap_free (p);
   free (p);
 }
 
-/* Add new page to the page_table. Returns success state */
+/* Add a new anonymous page to the page_table. Returns success state */
 bool
-page_new_page (void *page, enum page_flags flags, const char *file_name,
-               off_t ofs, uint32_t read_bytes)
+page_new_page (void *page, enum page_flags flags)
 {
-  if (pagedir_get_page (thread_current ()->pagedir, page) != NULL)
+  if (pagedir_get_page (thread_current ()->pagedir, page) != NULL
+      || region_lookup (page) != NULL)
+    return false;
+  struct page **slot = page_lookup (page, true);
+  if (slot == NULL || *slot != NULL)
     return false;
   // set up the page
   struct page *p = malloc (sizeof(struct page));
   if (p == NULL)
     return false;
-  if (file_name != NULL)
-    {
-      int length = strlen (file_name) + 1;
-      p->file_name = malloc (length * sizeof(char));
-      if (p->file_name == NULL)
-        {
-          free (p);
-          return false;
-        }
-      memcpy (p->file_name, file_name, length);
-      if (!(flags & PAGE_ZERO))
-        {
-          lock_acquire (&file_lock);
-          p->file = filesys_open (p->file_name);
-          lock_release (&file_lock);
-          if (p->file == NULL)
-            {
-              free (p->file_name);
-              free (p);
-              return false;
-            }
-        }
-      else
-        p->file = NULL;
-    }
-  else
-    {
-      p->file_name = NULL;
-      p->file = NULL;
-    }
-  p->tid = thread_tid ();
   p->uaddr = page;
+  p->kaddr = NULL;
   p->flags = flags;
-  p->ofs = ofs;
-  p->read_bytes = read_bytes;
-  p->last_accessed_time = timer_ticks ();
   p->pd = thread_current ()->pagedir;
-  p->pinned = flags & PAGE_SHARE;
+  p->region = NULL;
+  p->swap_slot = 0;
+  p->zswap = NULL;
+  p->frame_next = NULL;
 
   // Inset the page into the page_table
-  if (hash_insert (&thread_current ()->page_table, &p->pagehashelem) != NULL)
-    {
-      lock_acquire (&file_lock);
-      file_close (p->file);
-      lock_release (&file_lock);
-      free (p->file_name);
-      free (p);
+  *slot = p;
+  return true;
+}
+
+/* Adds a region of page_cnt pages at start to the current process,
+   backed by read_bytes bytes of file from ofs, which it reopens,
+   and zeros after that. Fails if any of the pages is already in
+   use. No page is loaded until it faults. Returns success state */
+bool
+page_new_region (void *start, size_t page_cnt, enum page_flags flags,
+                 struct file *file, off_t ofs, uint32_t read_bytes)
+{
+  struct thread *t = thread_current ();
+  uint8_t *end = (uint8_t *) start + page_cnt * PGSIZE;
+  uint8_t *uaddr;
+
+  ASSERT (pg_ofs (start) == 0);
+  if (page_cnt == 0 || end < (uint8_t *) start || !is_user_vaddr (end - 1))
+    return false;
+
+  // Regions are disjoint, so only the last one starting below end can
+  // overlap
+  struct region key;
+  key.start = end - 1;
+  struct splay_elem *e = splay_floor (&t->regions, &key.regionelem);
+  if (e != NULL
+      && splay_entry (e, struct region, regionelem)->end > start)
+    return false;
+  for (uaddr = start; uaddr < end; uaddr += PGSIZE)
+    if (page_get_page (uaddr) != NULL)
       return false;
-    }
+
+  struct region *r = region_create (start, end, flags, file, ofs,
+                                    read_bytes);
+  if (r == NULL)
+    return false;
+  splay_insert (&t->regions, &r->regionelem);
   return true;
 }
 
+/* Removes the region starting at start from the current process,
+   with all its pages */
+void
+page_remove_region (void *start)
+{
+  struct region *r = region_lookup (start);
+
+  if (r == NULL || r->start != start)
+    return;
+  page_remove_range (r->start, r->end);
+  splay_remove (&thread_current ()->regions, &r->regionelem);
+  region_destroy (r);
+}
+
 /* Get a page from page_table */
 struct page *
 page_get_page (void *page)
 {
-  struct hash_elem *e = page_lookup (page);
-  if (e == NULL)
-    return NULL;
-  return hash_entry (e, struct page, pagehashelem);
+  struct page **slot = page_lookup (page, false);
+  return slot != NULL ? *slot : NULL;
 }
 
 /* Removes page from page_table */
 void
 page_remove_page (void *page)
 {
-  struct hash_elem *e = hash_delete (&thread_current ()->page_table,
-                                     page_lookup (page));
-  if (e != NULL)
-    page_destroy (e, NULL);
+  struct page **slot = page_lookup (page, false);
+  if (slot == NULL || *slot == NULL)
+    return;
+  struct page *p = *slot;
+  *slot = NULL;
+  page_destroy (p);
+}
+
+/* Removes every page from start up to end from page_table, in
+   address order, skipping table pages that were never allocated */
+static void
+page_remove_range (uint8_t *start, uint8_t *end)
+{
+  struct page ***dir = thread_current ()->page_table;
+  uint8_t *uaddr = start;
+
+  while (uaddr < end)
+    {
+      struct page **table = dir[pd_no (uaddr)];
+      if (table == NULL)
+        {
+          // Skip to the start of the next table
+          uaddr = (uint8_t *) ((pd_no (uaddr) + 1) << PDSHIFT);
+          if (uaddr == NULL)
+            break;
+          continue;
+        }
+      struct page **slot = &table[pt_no (uaddr)];
+      if (*slot != NULL)
+        {
+          struct page *p = *slot;
+          *slot = NULL;
+          page_destroy (p);
+        }
+      uaddr += PGSIZE;
+    }
+}
+
+/* Returns the file p is loaded from and evicted to, or NULL if its
+   contents only exist in memory or swap */
+struct file *
+page_file (const struct page *p)
+{
+  if (p->region == NULL || (p->flags & PAGE_ANON))
+    return NULL;
+  return p->region->file;
+}
+
+/* Returns the offset in its region's file of p's contents */
+off_t
+page_file_ofs (const struct page *p)
+{
+  return p->region->ofs + ((uint8_t *) p->uaddr
+                           - (uint8_t *) p->region->start);
+}
+
+/* Returns the number of bytes of p that come from its region's
+   file. The rest of the page is zero */
+uint32_t
+page_read_bytes (const struct page *p)
+{
+  uint32_t ofs = (uint8_t *) p->uaddr - (uint8_t *) p->region->start;
+  if (p->region->read_bytes <= ofs)
+    return 0;
+  return p->region->read_bytes - ofs < PGSIZE
+         ? p->region->read_bytes - ofs : PGSIZE;
 }
 
 /* Load all zero page, page from swap or page from file to frame */
@@ -178,14 +324,32 @@ bool
 page_load_page (void *page, bool write)
 {
   page = pg_round_down (page);
-  struct hash_elem *e = page_lookup (page);
-  if (e == NULL)
-    return false;
-  struct page *p = hash_entry (e, struct page, pagehashelem);
+  struct page *p = page_get_page (page);
+  if (p == NULL)
+    {
+      // First touch of a page in a region
+      struct region *r = region_lookup (page);
+      if (r == NULL)
+        return false;
+      if (write && !(r->flags & PAGE_WRITABLE))
+        return false;
+      p = page_from_region (r, page);
+      if (p == NULL)
+        return false;
+    }
   bool writable = p->flags & PAGE_WRITABLE;
   if (write && !writable)
     return false;
 
+  if (!(p->flags & (PAGE_SWAP | PAGE_ZERO)))
+    {
+      // File-backed: load the page, then its neighbours
+      if (!page_load_file (p))
+        return false;
+      page_map_around (p);
+      return true;
+    }
+
   bool share = p->flags & PAGE_SHARE;
   if (share)
     if (page_load_shared (p))
@@ -193,7 +357,19 @@ page_load_page (void *page, bool write)
 
   if (p->flags & PAGE_SWAP)
     return swap_in (p);
-  else if (p->flags & PAGE_ZERO)
+  else if (!write && !share)
+    {
+      // Read of a private zero page: map the zero page until the first
+      // write copies it
+      if (!install_page (page, zero_kaddr, false))
+        return false;
+      if (writable)
+        p->flags |= PAGE_COW;
+      p->kaddr = zero_kaddr;
+      zero_map_cnt++;
+      return true;
+    }
+  else
     {
       void *kaddr = frame_get_page (PAL_USER | PAL_ZERO, p);
       if (kaddr == NULL)
@@ -203,187 +379,570 @@ page_load_page (void *page, bool write)
           frame_free_page (kaddr);
           return false;
         }
+      frame_unpin (kaddr);
       p->flags ^= PAGE_ZERO;
       p->kaddr = kaddr;
     }
-  else
+
+  if (share)
+    page_add_shared (p);
+
+  return true;
+}
+
+/* Gives child, a process being forked from the current one, a copy
+   of the current process's regions and pages.  Private pages that
+   are resident are shared copy-on-write: both processes map the
+   frame read-only until one of them writes to it.  Those in swap
+   are brought back in to be shared; the rest load from the child's
+   regions as they fault.  Pages of shared regions are left for the
+   child to find in the page cache.  On failure, whatever has been
+   copied goes when the child destroys its page_table */
+bool
+page_fork (struct thread *child)
+{
+  struct thread *t = thread_current ();
+  struct splay_elem *e;
+  size_t i, j;
+
+  splay_init (&child->regions, region_less, NULL);
+  child->page_table = palloc_get_page (PAL_ZERO);
+  if (child->page_table == NULL)
+    return false;
+  for (e = splay_first (&t->regions); e != NULL;
+       e = splay_next (&t->regions, e))
+    {
+      struct region *r = splay_entry (e, struct region, regionelem);
+      struct region *copy = region_create (r->start, r->end, r->flags,
+                                           r->file, r->ofs, r->read_bytes);
+      if (copy == NULL)
+        return false;
+      splay_insert (&child->regions, &copy->regionelem);
+    }
+
+  for (i = 0; i < pd_no (PHYS_BASE); i++)
     {
-      if (!lock_held_by_current_thread (&file_lock))
-        lock_acquire (&file_lock);
-      if (!load_segment (p->file, p->ofs, page, p->read_bytes,
-                         PGSIZE - p->read_bytes, writable))
+      struct page **table = t->page_table[i];
+      if (table != NULL)
+        for (j = 0; j < PGSIZE / sizeof *table; j++)
+          if (table[j] != NULL && !page_fork_page (child, table[j]))
+            return false;
+    }
+  return true;
+}
+
+/* Copies page p of the current process into child's page_table,
+   sharing its frame copy-on-write if it has one */
+static bool
+page_fork_page (struct thread *child, struct page *p)
+{
+  void *kaddr;
+
+  if (p->flags & PAGE_SHARE)
+    return true;
+  struct page **slot = page_slot (child->page_table, p->uaddr, true);
+  if (slot == NULL)
+    return false;
+  struct page *c = malloc (sizeof(struct page));
+  if (c == NULL)
+    return false;
+  c->uaddr = p->uaddr;
+  c->pd = child->pagedir;
+  c->region = p->region != NULL
+              ? region_find (&child->regions, p->uaddr) : NULL;
+  c->swap_slot = 0;
+  c->zswap = NULL;
+  c->frame_next = NULL;
+
+  for (;;)
+    {
+      kaddr = pagedir_get_page (p->pd, p->uaddr);
+      if (kaddr == NULL)
         {
-          if (lock_held_by_current_thread (&file_lock))
-            lock_release (&file_lock);
+          // Not resident.  Unless it is in swap, the page still holds
+          // what its region says, and the child loads it from there
+          if (!(p->flags & PAGE_SWAP))
+            {
+              free (c);
+              return true;
+            }
+          if (!page_load_page (p->uaddr, false))
+            {
+              free (c);
+              return false;
+            }
+          continue;
+        }
+      if (!pagedir_set_page (child->pagedir, c->uaddr, kaddr, false))
+        {
+          free (c);
           return false;
         }
+      if (kaddr == zero_kaddr)
+        {
+          // Both read the zero page until they write
+          c->kaddr = kaddr;
+          c->flags = p->flags & (PAGE_WRITABLE | PAGE_ZERO | PAGE_COW);
+          *slot = c;
+          return true;
+        }
+      if (frame_share (kaddr, p, c))
+        break;
+      // The frame is being evicted or cleaned: wait for that to finish
+      pagedir_clear_page (child->pagedir, c->uaddr);
+      thread_yield ();
+    }
+
+  // The frame can no longer be evicted or cleaned, so p's flags and
+  // dirty bit are stable.  The child's dirty bit carries over whether
+  // the contents still match the file
+  c->kaddr = kaddr;
+  c->flags = p->flags & (PAGE_WRITABLE | PAGE_ANON);
+  if (pagedir_is_dirty (p->pd, p->uaddr))
+    pagedir_set_dirty (c->pd, c->uaddr, true);
+  if (p->flags & PAGE_WRITABLE)
+    {
+      pagedir_set_writable (p->pd, p->uaddr, false);
+      p->flags |= PAGE_COW;
+      c->flags |= PAGE_COW;
+    }
+  *slot = c;
+  return true;
+}
+
+/* Handles a write to uaddr in the current process that faulted
+   because its page shares a frame copy-on-write or maps the zero
+   page.  The page gets a frame of its own, or, if no other page maps
+   its frame any more, keeps it and is made writable again.  Returns
+   false if uaddr is not in a copy-on-write page */
+bool
+page_cow_fault (void *uaddr)
+{
+  struct page *p = page_get_page (pg_round_down (uaddr));
+  void *kaddr;
+
+  if (p == NULL || !(p->flags & PAGE_COW))
+    return false;
+  if (pagedir_get_page (p->pd, p->uaddr) == zero_kaddr)
+    {
+      // First write to a zero page
+      kaddr = frame_get_page (PAL_USER | PAL_ZERO, p);
+      pagedir_clear_page (p->pd, p->uaddr);
+      pagedir_set_page (p->pd, p->uaddr, kaddr, true);
+      frame_unpin (kaddr);
+      p->kaddr = kaddr;
+      p->flags &= ~(PAGE_COW | PAGE_ZERO);
+      zero_copy_cnt++;
+      return true;
+    }
+  for (;;)
+    {
+      kaddr = pagedir_get_page (p->pd, p->uaddr);
+      if (kaddr == NULL)
+        return true; // Evicted meanwhile: the write faults it back in
+      if (frame_pin (kaddr, p))
+        break;
+      thread_yield ();
+    }
+
+  if (frame_refs (kaddr) > 1)
+    {
+      // Take a copy while still on the frame's chain, so that no other
+      // page can take the frame over and write to it
+      void *copy = frame_get_page (PAL_USER, p);
+      memcpy (copy, kaddr, PGSIZE);
+      pagedir_clear_page (p->pd, p->uaddr);
+      if (frame_unshare (kaddr, p))
+        frame_free_page (kaddr);
+      pagedir_set_page (p->pd, p->uaddr, copy, true);
+      frame_unpin (copy);
+      p->kaddr = copy;
+    }
+  else
+    {
+      frame_unpin (kaddr);
+      pagedir_set_writable (p->pd, p->uaddr, true);
+    }
+  p->flags &= ~PAGE_COW;
+  return true;
+}
+
+/* Creates the page at uaddr of region r in the current process's
+   page_table. Returns NULL on failure */
+static struct page *
+page_from_region (struct region *r, void *uaddr)
+{
+  struct page **slot = page_lookup (uaddr, true);
+  if (slot == NULL)
+    return NULL;
+  ASSERT (*slot == NULL);
+  struct page *p = malloc (sizeof(struct page));
+  if (p == NULL)
+    return NULL;
+  p->uaddr = uaddr;
+  p->kaddr = NULL;
+  p->pd = thread_current ()->pagedir;
+  p->region = r;
+  p->flags = r->flags;
+  p->swap_slot = 0;
+  p->zswap = NULL;
+  p->frame_next = NULL;
+  if (page_read_bytes (p) == 0)
+    p->flags |= PAGE_ZERO;
+  *slot = p;
+  return p;
+}
+
+/* Load a file-backed page, from the page cache if possible */
+static bool
+page_load_file (struct page *p)
+{
+  bool share = p->flags & PAGE_SHARE;
+  if (share)
+    if (page_load_shared (p))
+      return true;
+
+  uint32_t read_bytes = page_read_bytes (p);
+  if (!lock_held_by_current_thread (&file_lock))
+    lock_acquire (&file_lock);
+  if (!load_segment (page_file (p), page_file_ofs (p), p->uaddr, read_bytes,
+                     PGSIZE - read_bytes, p->flags & PAGE_WRITABLE))
+    {
       if (lock_held_by_current_thread (&file_lock))
         lock_release (&file_lock);
+      return false;
     }
+  if (lock_held_by_current_thread (&file_lock))
+    lock_release (&file_lock);
 
   if (share)
     page_add_shared (p);
-
   return true;
 }
 
-/* Add a mapping for shared page for the current process */
+/* Fault-around: after a fault on file-backed page p, also map the
+   pages that follow it in its region, up to the current thread's
+   window.  The window doubles, up to page_fault_around, each time
+   a fault lands just past the previous window, and halves on any
+   other fault.  Nothing is mapped ahead while frames are scarce */
+static void
+page_map_around (struct page *p)
+{
+  struct thread *t = thread_current ();
+  uint8_t *uaddr = p->uaddr;
+  size_t i, loaded = 0;
+
+  if ((void *) uaddr == t->fault_next)
+    t->fault_window = t->fault_window == 0 ? 1 : t->fault_window * 2;
+  else
+    t->fault_window /= 2;
+  if (t->fault_window > page_fault_around)
+    t->fault_window = page_fault_around;
+
+  for (i = 1; i <= t->fault_window && !frame_scarce (); i++)
+    {
+      void *next = uaddr + i * PGSIZE;
+      if (next >= p->region->end)
+        break;
+      struct page *q = page_get_page (next);
+      if (q == NULL)
+        {
+          q = page_from_region (p->region, next);
+          if (q == NULL)
+            break;
+        }
+      if (q->flags & (PAGE_SWAP | PAGE_ZERO | PAGE_ANON)
+          || pagedir_get_page (t->pagedir, next) != NULL)
+        break;
+      if (!page_load_file (q))
+        break;
+      loaded++;
+    }
+  t->fault_next = uaddr + (loaded + 1) * PGSIZE;
+}
+
+/* Maps p to its page in the page cache, if it is there.  Returns
+   false on a miss */
 static bool
 page_load_shared (struct page *p)
 {
-  lock_acquire (&shared_lock);
-  struct hash_elem *e = page_shared_lookup (p->file_name, p->ofs);
-  if (e != NULL)
+  for (;;)
     {
-      struct shared *s = hash_entry (e, struct shared, sharedhashelem);
-      if (install_page (p->uaddr, s->kaddr, p->flags & PAGE_WRITABLE))
+      lock_acquire (&cache_lock);
+      struct cached_page *c = page_cache_lookup (p);
+      if (c == NULL)
+        {
+          cache_miss_cnt++;
+          lock_release (&cache_lock);
+          return false;
+        }
+      if (!install_page (p->uaddr, c->kaddr, p->flags & PAGE_WRITABLE))
+        {
+          lock_release (&cache_lock);
+          return false;
+        }
+      if (frame_share (c->kaddr, NULL, p))
         {
-          s->share_count++;
           p->flags |= PAGE_FRAME;
-          lock_release (&shared_lock);
+          p->kaddr = c->kaddr;
+          cache_hit_cnt++;
+          lock_release (&cache_lock);
           return true;
         }
+      // Being evicted: wait for it to go, then load the page afresh
+      pagedir_clear_page (p->pd, p->uaddr);
+      lock_release (&cache_lock);
+      thread_yield ();
     }
-  lock_release (&shared_lock);
-  return false;
 }
 
-/* Remove the mapping for shared page for the current process */
+/* Unmaps p from its frame in the page cache.  The last page to
+   unmap a frame drops it from the cache, writing it back to its
+   file first if any page dirtied it */
 static void
 page_unload_shared (struct page *p)
 {
-  if (!(p->flags & PAGE_FRAME))
-    return;
+  void *kaddr;
 
-  lock_acquire (&shared_lock);
-  struct hash_elem *e = page_shared_lookup (p->file_name, p->ofs);
-  if (e != NULL)
+  for (;;)
     {
-      struct shared *s = hash_entry (e, struct shared, sharedhashelem);
-      uint32_t *pd = thread_current ()->pagedir;
-      s->dirty = pagedir_is_dirty (pd, p->uaddr);
-      s->share_count--;
-      if (s->share_count == 0)
+      lock_acquire (&cache_lock);
+      if (!(p->flags & PAGE_FRAME))
         {
-          hash_delete (&shared_pages, e);
-          lock_acquire (&file_lock);
-          if (s->dirty)
-            {
-              file_seek (s->file, s->ofs);
-              file_write (s->file, p->uaddr, s->read_bytes);
-            }
-          file_close (s->file);
-          lock_release (&file_lock);
-          frame_free_page (s->kaddr);
-          free (s->file_name);
-          free (s);
+          lock_release (&cache_lock);
+          return;
         }
-      pagedir_clear_page (pd, p->uaddr);
+      kaddr = pagedir_get_page (p->pd, p->uaddr);
+      if (frame_pin (kaddr, p))
+        break;
+      // Being evicted, which unmaps p
+      lock_release (&cache_lock);
+      thread_yield ();
+    }
+
+  struct cached_page *c = page_cache_lookup (p);
+  pagedir_clear_page (p->pd, p->uaddr);
+  c->dirty |= pagedir_is_dirty (p->pd, p->uaddr);
+  p->flags &= ~PAGE_FRAME;
+  bool last = frame_unshare (kaddr, p);
+  if (last)
+    hash_delete (&page_cache, &c->cachehashelem);
+  lock_release (&cache_lock);
+
+  if (last)
+    {
+      page_cache_drop (c);
+      frame_free_page (kaddr);
     }
-  lock_release (&shared_lock);
 }
 
-/* Add a page to shared_pages. Returns success state */
-static bool
+/* Adds the frame p has just been loaded into to the page cache,
+   unless another process has cached the same page meanwhile, in
+   which case p keeps its frame to itself */
+static void
 page_add_shared (struct page *p)
 {
-  lock_acquire (&shared_lock);
-  struct hash_elem *e = page_shared_lookup (p->file_name, p->ofs);
-  if (e == NULL)
+  void *kaddr = pagedir_get_page (p->pd, p->uaddr);
+  if (kaddr == NULL)
+    return;
+  struct cached_page *c = malloc (sizeof(struct cached_page));
+  if (c == NULL)
+    return;
+  bool held = lock_held_by_current_thread (&file_lock);
+  if (!held)
+    lock_acquire (&file_lock);
+  c->inode = inode_reopen (file_get_inode (p->region->file));
+  if (!held)
+    lock_release (&file_lock);
+  c->index = page_file_ofs (p) / PGSIZE;
+  c->kaddr = kaddr;
+  c->write_bytes = p->flags & PAGE_WRITABLE ? page_read_bytes (p) : 0;
+  c->dirty = false;
+
+  // Pinning keeps the frame from being evicted as a private page
+  // before PAGE_FRAME is set
+  if (frame_pin (kaddr, p))
     {
-      struct shared *s = malloc (sizeof(struct shared));
-      if (s == NULL)
-        return false;
-      int length = strlen (p->file_name) + 1;
-      s->file_name = malloc (length * sizeof(char));
-      if (s->file_name == NULL)
-        {
-          free (s);
-          lock_release (&shared_lock);
-          return false;
-        }
-      memcpy (s->file_name, p->file_name, length);
-      if (!lock_held_by_current_thread (&file_lock))
-        lock_acquire (&file_lock);
-      s->file = filesys_open (s->file_name);
-      if (lock_held_by_current_thread (&file_lock))
-        lock_release (&file_lock);
-      if (s->file == NULL)
+      lock_acquire (&cache_lock);
+      if (page_cache_lookup (p) == NULL)
         {
-          free (s->file_name);
-          free (s);
-          lock_release (&shared_lock);
-          return false;
+          hash_insert (&page_cache, &c->cachehashelem);
+          p->flags |= PAGE_FRAME;
+          c = NULL;
         }
-      s->kaddr = pagedir_get_page (thread_current ()->pagedir, p->uaddr);
-      s->ofs = p->ofs;
-      s->read_bytes = p->flags & PAGE_WRITABLE ? p->read_bytes : 0;
-      s->dirty = false;
-      s->share_count = 1;
-      hash_insert (&shared_pages, &s->sharedhashelem);
+      lock_release (&cache_lock);
+      frame_unpin (kaddr);
     }
-  else
-    hash_entry (e, struct shared, sharedhashelem)->share_count++;
-  p->flags |= PAGE_FRAME;
-  lock_release (&shared_lock);
-  return true;
+  if (c != NULL)
+    page_cache_drop (c);
 }
 
-/* Hash helper for the page_table hash_table */
-static unsigned
-page_hash (const struct hash_elem *e, void *aux UNUSED)
+/* Evicts the cached frame that page p heads the chain of, which
+   frame_evict() has marked as being evicted, so that no page can
+   map or unmap it meanwhile.  Unmaps it from every page and drops it
+   from the cache, writing it back to its file first if any page
+   dirtied it.  The caller frees the frame */
+void
+page_cache_evict (struct page *p)
 {
-  const struct page *p = hash_entry (e, struct page, pagehashelem);
-  return hash_bytes (&p->uaddr, sizeof p->uaddr);
+  lock_acquire (&cache_lock);
+  struct cached_page *c = page_cache_lookup (p);
+  while (p != NULL)
+    {
+      struct page *next = p->frame_next;
+      pagedir_clear_page (p->pd, p->uaddr);
+      c->dirty |= pagedir_is_dirty (p->pd, p->uaddr);
+      p->flags &= ~PAGE_FRAME;
+      p->frame_next = NULL;
+      p = next;
+    }
+  hash_delete (&page_cache, &c->cachehashelem);
+  cache_evict_cnt++;
+  lock_release (&cache_lock);
+  page_cache_drop (c);
 }
 
-/* Hash helper for the page_table hash_table */
-static bool
-page_less (const struct hash_elem *a, const struct hash_elem *b,
-           void *aux UNUSED)
+/* Frees page cache entry c, which is not in page_cache, writing its
+   frame back first if it is dirty */
+static void
+page_cache_drop (struct cached_page *c)
 {
-  return hash_entry (a, struct page, pagehashelem)->uaddr <
-  hash_entry (b, struct page, pagehashelem)->uaddr;
+  bool held = lock_held_by_current_thread (&file_lock);
+  if (!held)
+    lock_acquire (&file_lock);
+  if (c->dirty && c->write_bytes > 0)
+    inode_write_at (c->inode, c->kaddr, c->write_bytes, c->index * PGSIZE);
+  inode_close (c->inode);
+  if (!held)
+    lock_release (&file_lock);
+  free (c);
 }
 
-/* Returns the hash_elem corresponding to the given user virtual address */
-struct hash_elem *
-page_lookup (const void *uaddr)
+/* Returns the page_table slot for the given user virtual address.
+   If its table page does not exist, allocates it if create is
+   true, and otherwise returns NULL, as it also does if allocation
+   fails or uaddr is not a user address */
+static struct page **
+page_lookup (const void *uaddr, bool create)
 {
-  struct page p;
-  p.uaddr = uaddr;
-  return hash_find (&thread_current ()->page_table, &p.pagehashelem);
+  return page_slot (thread_current ()->page_table, uaddr, create);
 }
 
-/* Hash helper for the shared_pages hash_table */
+/* As page_lookup(), in the page_table whose directory is dir */
+static struct page **
+page_slot (struct page ***dir, const void *uaddr, bool create)
+{
+  struct page ***pde;
+
+  if (!is_user_vaddr (uaddr))
+    return NULL;
+  pde = &dir[pd_no (uaddr)];
+  if (*pde == NULL)
+    {
+      if (!create)
+        return NULL;
+      *pde = palloc_get_page (PAL_ZERO);
+      if (*pde == NULL)
+        return NULL;
+    }
+  return &(*pde)[pt_no (uaddr)];
+}
+
+/* Hash helper for the page_cache hash_table */
 static unsigned
-page_shared_hash (const struct hash_elem *e, void *aux UNUSED)
+page_cache_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  const struct shared *s = hash_entry (e, struct shared, sharedhashelem);
-  return hash_string (s->file_name) ^ hash_int (s->ofs);
+  const struct cached_page *c = hash_entry (e, struct cached_page,
+                                            cachehashelem);
+  return hash_bytes (&c->inode, sizeof c->inode) ^ hash_int (c->index);
 }
 
-/* Hash helper for the shared_pages hash_table */
+/* Hash helper for the page_cache hash_table */
 static bool
-page_shared_less (const struct hash_elem *a, const struct hash_elem *b,
-                  void *aux UNUSED)
-{
-  struct shared *s_a = hash_entry (a, struct shared, sharedhashelem);
-  struct shared *s_b = hash_entry (b, struct shared, sharedhashelem);
-  int cmp = strcmp (s_a->file_name, s_b->file_name);
-  if (cmp == 0)
-    return s_a->ofs < s_b->ofs;
-  else
-    return cmp < 0;
+page_cache_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  const struct cached_page *c_a = hash_entry (a, struct cached_page,
+                                              cachehashelem);
+  const struct cached_page *c_b = hash_entry (b, struct cached_page,
+                                              cachehashelem);
+  if (c_a->inode != c_b->inode)
+    return c_a->inode < c_b->inode;
+  return c_a->index < c_b->index;
+}
+
+/* Returns the page cache entry for the page of its region's file that
+   p is backed by, or NULL.  Caller needs to hold cache_lock */
+static struct cached_page *
+page_cache_lookup (const struct page *p)
+{
+  struct cached_page key;
+  key.inode = file_get_inode (p->region->file);
+  key.index = page_file_ofs (p) / PGSIZE;
+  struct hash_elem *e = hash_find (&page_cache, &key.cachehashelem);
+  return e != NULL ? hash_entry (e, struct cached_page, cachehashelem) : NULL;
 }
 
-/* Returns the hash_elem corresponding to the given file_name and offset */
-static struct hash_elem *
-page_shared_lookup (const char *file_name, off_t ofs)
+/* Tree helper for the regions tree */
+static bool
+region_less (const struct splay_elem *a, const struct splay_elem *b,
+             void *aux UNUSED)
+{
+  return splay_entry (a, struct region, regionelem)->start <
+  splay_entry (b, struct region, regionelem)->start;
+}
+
+/* Returns the current process's region containing uaddr, or NULL */
+static struct region *
+region_lookup (const void *uaddr)
 {
-  //Caller needs to hold frame_lock already
-  struct shared s;
-  s.file_name = file_name;
-  s.ofs = ofs;
-  return hash_find (&shared_pages, &s.sharedhashelem);
+  return region_find (&thread_current ()->regions, uaddr);
+}
+
+/* Returns the region in regions containing uaddr, or NULL */
+static struct region *
+region_find (struct splay *regions, const void *uaddr)
+{
+  struct region key;
+  key.start = (void *) uaddr;
+  struct splay_elem *e = splay_floor (regions, &key.regionelem);
+  if (e == NULL)
+    return NULL;
+  struct region *r = splay_entry (e, struct region, regionelem);
+  return uaddr < r->end ? r : NULL;
+}
+
+/* Returns a new region from start to end backed by file, which it
+   reopens, as page_new_region() describes, or NULL on failure */
+static struct region *
+region_create (void *start, void *end, enum page_flags flags,
+               struct file *file, off_t ofs, uint32_t read_bytes)
+{
+  struct region *r = malloc (sizeof(struct region));
+  if (r == NULL)
+    return NULL;
+  lock_acquire (&file_lock);
+  r->file = file_reopen (file);
+  lock_release (&file_lock);
+  if (r->file == NULL)
+    {
+      free (r);
+      return NULL;
+    }
+  r->start = start;
+  r->end = end;
+  r->flags = flags & (PAGE_WRITABLE | PAGE_SHARE);
+  r->ofs = ofs;
+  r->read_bytes = read_bytes;
+  return r;
+}
+
+/* Closes region r's file and frees it */
+static void
+region_destroy (struct region *r)
+{
+  lock_acquire (&file_lock);
+  file_close (r->file);
+  lock_release (&file_lock);
+  free (r);
 }
@@ -2,6 +2,7 @@
 #define VM_PAGE_H
 
 #include <hash.h>
+#include <splay.h>
 #include <stdbool.h>
 #include "threads/thread.h"
 #include "filesys/off_t.h"
@@ -12,35 +13,63 @@ enum page_flags
   PAGE_WRITABLE = 2,
   PAGE_SHARE = 4,
   PAGE_FRAME = 8,
-  PAGE_SWAP = 16
+  PAGE_SWAP = 16,
+  PAGE_ZSWAP = 32,
+  PAGE_ANON = 64,         // contents no longer match the region's file
+  PAGE_COW = 128          // mapped read-only until written: a frame shared
+                          // with a forked process, or the zero page
 };
 
-/* A struct for pages, containing fields used to handle page_faults */
+/* A region of a process's address space (a VMA), such as an ELF
+   segment or an mmapped file, described once for all its pages.
+   Page i of the region holds read_bytes - i * PGSIZE bytes of
+   file from offset ofs + i * PGSIZE, as far as that is positive
+   and at most PGSIZE, and zeros after that */
+struct region
+  {
+    struct splay_elem regionelem;
+    void *start;                // first page
+    void *end;                  // one past the last page
+    enum page_flags flags;      // PAGE_WRITABLE and PAGE_SHARE
+    struct file *file;          // its inode keys the page cache
+    off_t ofs;
+    uint32_t read_bytes;
+  };
+
+/* A struct for pages, containing fields used to handle page_faults.
+   Created when a page is first loaded */
 struct page
   {
-    struct hash_elem pagehashelem;
-    tid_t tid;
     void *uaddr;
     void *kaddr;
     enum page_flags flags;
-    char *file_name;
-    struct file *file;
-    off_t ofs;
-    uint32_t read_bytes;
-    int64_t last_accessed_time;
     uint32_t *pd;
-    bool pinned;
+    struct region *region;      // NULL for anonymous (stack) pages
+    size_t swap_slot;           // Slot in swap, valid if PAGE_SWAP is set
+    struct zswap_entry *zswap;  // Compressed copy, valid if PAGE_ZSWAP is set
+    struct page *frame_next;    // Next page mapping the same frame, see frame.h
   };
 
+extern size_t page_fault_around;
+
 void page_init (void);
 void page_done (void);
-bool page_create_table (struct hash *page_table);
-void page_destroy_table (struct hash *page_table);
-bool page_new_page (void *page, enum page_flags flags, const char *file_name,
-                    off_t ofs, uint32_t read_bytes);
+bool page_create_table (void);
+void page_destroy_table (void);
+bool page_new_page (void *page, enum page_flags flags);
+bool page_new_region (void *start, size_t page_cnt, enum page_flags flags,
+                      struct file *file, off_t ofs, uint32_t read_bytes);
+void page_remove_region (void *start);
 struct page *page_get_page (void *page);
 void page_remove_page (void *page);
 bool page_load_page (void *page, bool write);
+bool page_fork (struct thread *child);
+bool page_cow_fault (void *uaddr);
+void page_cache_evict (struct page *p);
+void page_print_stats (void);
+struct file *page_file (const struct page *p);
+off_t page_file_ofs (const struct page *p);
+uint32_t page_read_bytes (const struct page *p);
 
 
 #endif /* vm_page_h */
@@ -1,199 +1,343 @@
 #include "vm/swap.h"
 #include <bitmap.h>
-#include <hash.h>
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
-#include "threads/thread.h"
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
-#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "vm/frame.h"
+#include "vm/zswap.h"
+
+#define SECTORS_IN_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Clustering.  The swap partition is carved into runs of
+   SWAP_CLUSTER slots, each holding an aligned window of
+   SWAP_CLUSTER virtual pages of one address space, in address
+   order.  Virtually adjacent victims therefore land in adjacent
+   slots, whichever order they are evicted in, and can be read
+   back with one disk command.  The last OPEN_CLUSTERS runs handed
+   out are remembered so later victims from the same window can
+   find them. */
+#define SWAP_CLUSTER 8 // slots per cluster, also the readahead window
+#define OPEN_CLUSTERS 16 // clusters remembered for placement
+struct cluster
+  {
+    uint32_t *pd; // address space, or NULL if unused
+    uintptr_t vbase; // first virtual page number of the window
+    size_t base; // first slot of the run
+  };
+static struct cluster clusters[OPEN_CLUSTERS];
+static size_t cluster_next; // Next entry of clusters to replace
 
-#define SECTORS_IN_PAGE 8
+/* Swap cache.  On a swap-in miss the run of slots around the
+   faulting one that belongs to the same address space is read in
+   a single request into cache_buf, and the neighbours are kept
+   there until they are faulted in, freed, or replaced by the next
+   readahead. */
+static uint8_t *cache_buf; // SWAP_CLUSTER pages
+static size_t cache_base; // Slot held in the first page of cache_buf
+static bool cache_valid[SWAP_CLUSTER]; // Page holds an unconsumed slot
+static struct lock cache_lock; // Protects the cache, taken before swap_lock
 
 /* Lock for synchronising swaps */
 static struct lock swap_lock;
 /* The block that takes care of the actual swapping */
 static struct block *swap_block;
-/* A Bitmap to store the position of swapped pages in the swap partition */
-static struct bitmap *sector_bm;
-/* A hashmap for the actual swap table */
-static struct hash swap_table;
-
-int64_t swap_free(struct page *page);
-
-static unsigned swap_hash (const struct hash_elem *e, void *aux UNUSED);
-static bool swap_less (const struct hash_elem *a, const struct hash_elem *b,
-                       void *aux UNUSED);
-static struct hash_elem *swap_lookup (void *kaddr, tid_t tid);
-
-/* The swap-table elements contain the virtual user address and the sector they are in */
-struct swap {
-  struct hash_elem swaphashelem;
-  tid_t tid;
-  void *kaddr;
-  uint32_t sector;
-};
+/* A Bitmap of used page-sized slots in the swap partition */
+static struct bitmap *slot_bm;
+/* Address space whose page each used slot holds */
+static uint32_t **slot_owner;
+/* Pages holding each used slot, more than one for a frame that was
+   shared copy-on-write when it was swapped out */
+static unsigned *slot_refs;
+/* Next-fit cursor: slot just after the last one allocated */
+static size_t slot_cursor;
+
+/* Statistics */
+static long long out_cnt; // pages written to the swap partition
+static long long in_cnt; // pages read back from the swap partition
+static long long ahead_cnt; // pages read ahead into the swap cache
+static long long hit_cnt; // swap-ins served from the swap cache
+static long long waste_cnt; // pages read ahead but never used
+
+static size_t swap_alloc_slot (struct page *page);
+static void cache_drop (size_t slot);
+static void swap_read (struct page *page, void *kaddr);
 
 /* Initialises the global static variables */
 void
 swap_init (void)
 {
+  size_t slot_cnt;
+
   swap_block = block_get_role(BLOCK_SWAP);
   if(swap_block == NULL)
     PANIC("ERROR: Couldn't initialise swap_table instance");
   lock_init(&swap_lock);
-  sector_bm = bitmap_create(block_size(swap_block));
-  hash_init (&swap_table, swap_hash, swap_less, NULL);
+  lock_init(&cache_lock);
+  slot_cnt = block_size(swap_block) / SECTORS_IN_PAGE;
+  slot_bm = bitmap_create(slot_cnt);
+  slot_owner = calloc(slot_cnt, sizeof *slot_owner);
+  slot_refs = calloc(slot_cnt, sizeof *slot_refs);
+  if (slot_bm == NULL
+      || ((slot_owner == NULL || slot_refs == NULL) && slot_cnt > 0))
+    PANIC("ERROR: Couldn't allocate swap slot bitmap");
+  slot_cursor = 0;
+  cache_buf = palloc_get_multiple(PAL_ASSERT, SWAP_CLUSTER);
+  zswap_init();
 }
 
 /* Swaps a page from the swap partition back into memory */
 bool
 swap_in(struct page *page)
 {
-  void *kaddr = frame_get_page(PAL_ZERO | PAL_USER, page);
-  ASSERT (kaddr!=NULL);
-  int64_t bm_sector = swap_free(page);
-  // if doesn't exist, return failure of loading in
-  if (bm_sector == -1)
-    {
-
-  printf("swap_in\n");
-    return false;
-    }
-  // Set up a buffer to read page into
-  void* buffer = malloc(BLOCK_SECTOR_SIZE);
-  if (buffer == NULL)
+  if (!(page->flags & PAGE_SWAP))
     return false;
-  // Read all SECTORS_IN_PAGE sectors from the swap partition into memory
-  int i;
-  for (i = 0; i < SECTORS_IN_PAGE; i++)
+  void *kaddr = frame_get_page(PAL_USER, page);
+  ASSERT (kaddr!=NULL);
+  if (zswap_load(page, kaddr))
+    page->flags &= ~PAGE_SWAP;
+  else
     {
-      block_read(swap_block, bm_sector + i, buffer);
-      ASSERT (kaddr + (i*BLOCK_SECTOR_SIZE) !=NULL);
-      memcpy(kaddr + (i*BLOCK_SECTOR_SIZE), buffer, BLOCK_SECTOR_SIZE);
+      swap_read(page, kaddr);
+      // Release the slot, which also clears the swap flag
+      swap_free(page);
     }
-  free(buffer);
-  // Clear swap flag in supplementary page table entry
-  page->flags &= ~PAGE_SWAP;
   page->kaddr = kaddr;
   install_page(page->uaddr,kaddr,page->flags & PAGE_WRITABLE);
+  frame_unpin(kaddr);
   // Loading back successful, return true
   return true;
 }
 
-/* Removes page from swap_table and updates bitmap */
-int64_t
+/* Releases the swap slot held by page, if any.  The slot itself is
+   freed once no page holds it */
+void
 swap_free(struct page *page)
 {
-  // Acquire the swap table element to delete
-  lock_acquire (&swap_lock);
-  struct swap *s = hash_entry(swap_lookup(page->kaddr, page->tid), struct swap, swaphashelem);
-  lock_release (&swap_lock);
-
-  // If element is found:
-  if (s != NULL)
+  if (!(page->flags & PAGE_SWAP))
+    return;
+  if (!zswap_drop(page))
     {
-      // get the sector of the swap partition where the page is stored
-      size_t bm_sector = s->sector;
-      // Delete the swap_table element
+      lock_acquire (&cache_lock);
       lock_acquire (&swap_lock);
-      hash_delete(&swap_table, &s->swaphashelem);
+      if (--slot_refs[page->swap_slot] == 0)
+        {
+          cache_drop (page->swap_slot);
+          bitmap_reset(slot_bm, page->swap_slot);
+          slot_owner[page->swap_slot] = NULL;
+        }
       lock_release (&swap_lock);
-
-      // free the element
-      free(s);
-      // update the bitmap
-      bitmap_scan_and_flip(sector_bm, bm_sector, SECTORS_IN_PAGE, true);
-      //return the sector where the page is stored
-      printf("swap_free: before\n");
-      return bm_sector;
+      lock_release (&cache_lock);
     }
-  // If element is not found, return invalid index -1
-  printf("swap_free: after\n");
-  return -1;
+  page->flags &= ~PAGE_SWAP;
 }
 
 /* Swaps a page from memory into the swap partition */
 bool
 swap_out(struct page *page)
 {
-//  printf("swap_out: %d: %s (%d)\n", page->tid, page->file_name, (int)page->kaddr);
-  // mark swap_table entry in bitmap
-  size_t bm_sector = bitmap_scan_and_flip(sector_bm, 0, SECTORS_IN_PAGE, false);
-  // Panic the kernel if there is no space on the partition
-  if(bm_sector == BITMAP_ERROR)
-    PANIC("ERROR: Swap partition full!");
-  //create swap_table entry
-  struct swap *s = malloc (sizeof(struct swap));
-  if (s == NULL)
-    PANIC ("swap_multiple: out of memory");
-  s->kaddr = page->kaddr;
-  s->sector = bm_sector;
-  s->tid = page->tid;
-  // Insert the entry into the swap_table
-  lock_acquire (&swap_lock);
-  hash_insert (&swap_table, &s->swaphashelem);
-  lock_release (&swap_lock);
-  // Copy page from frame into SECTORS_IN_PAGE sectors in the swap partition
-  void* buffer = malloc(BLOCK_SECTOR_SIZE);
-  if (buffer == NULL)
-    PANIC ("swap_multiple: out of memory");
-  int i;
-  for (i = 0; i < SECTORS_IN_PAGE; i++)
+  ASSERT (!(page->flags & PAGE_SWAP));
+  // Try the compressed tier first, then the swap partition
+  if (!zswap_store(page))
+    swap_spill(page, page->kaddr);
+  // The page's contents now live in swap, not in any file
+  page->flags |= PAGE_SWAP | PAGE_ANON;
+  return true;
+}
+
+/* Swaps out page, one of several pages sharing a frame copy-on-write,
+   so that they all share one copy in swap.  The first page, with
+   COPY null, writes the frame to a new slot of the swap partition;
+   each later one takes a reference to the slot of COPY, the first
+   page.  The compressed tier is skipped, since its entries belong to
+   a single page */
+void
+swap_out_shared(struct page *page, const struct page *copy)
+{
+  ASSERT (!(page->flags & PAGE_SWAP));
+  if (copy == NULL)
+    swap_spill(page, page->kaddr);
+  else
     {
-      memcpy(buffer, page->kaddr + (i*BLOCK_SECTOR_SIZE), BLOCK_SECTOR_SIZE);
-      block_write(swap_block, bm_sector + i, buffer);
+      lock_acquire (&swap_lock);
+      slot_refs[copy->swap_slot]++;
+      lock_release (&swap_lock);
+      page->swap_slot = copy->swap_slot;
     }
-  free(buffer);
-  // Set swap flag in supplementary page table entry
-  page->flags |= PAGE_SWAP;
-  return true;
+  page->flags |= PAGE_SWAP | PAGE_ANON;
+}
+
+/* Writes the page of data to a new slot in the swap partition and
+   records the slot in page */
+void
+swap_spill(struct page *page, const void *data)
+{
+  size_t slot = swap_alloc_slot(page);
+  // Write the whole page to the swap partition with one disk command
+  block_write_multi(swap_block, slot * SECTORS_IN_PAGE, data,
+                    SECTORS_IN_PAGE);
+  // Record the slot in the supplementary page table entry
+  page->swap_slot = slot;
+  lock_acquire (&swap_lock);
+  out_cnt++;
+  lock_release (&swap_lock);
 }
 
-/* Hash helper for the swap_table hash_table */
-static unsigned
-swap_hash (const struct hash_elem *e, void *aux UNUSED)
+/* Prints swap statistics */
+void
+swap_print_stats (void)
 {
-  const struct swap *s = hash_entry (e, struct swap, swaphashelem);
-  return hash_bytes (s->kaddr, sizeof s->kaddr) ^ hash_int (s->tid);
+  if (slot_bm == NULL)
+    return;
+  printf ("Swap: %lld pages out, %lld pages in, %lld read ahead, "
+          "%lld cache hits, %lld wasted\n",
+          out_cnt, in_cnt, ahead_cnt, hit_cnt, waste_cnt);
+  zswap_print_stats ();
 }
 
-/* Hash helper for the swap_table hash_table */
-static bool
-swap_less (const struct hash_elem *a, const struct hash_elem *b,
-           void *aux UNUSED)
+/* Reads page's contents from swap into the frame at kaddr, from
+   the swap cache if it is there, otherwise together with the
+   neighbouring slots of its cluster that belong to the same
+   address space */
+static void
+swap_read (struct page *page, void *kaddr)
 {
-  struct swap *s1 = hash_entry (a, struct swap, swaphashelem);
-  struct swap *s2 = hash_entry (b, struct swap, swaphashelem);
-  if (s1->tid == s2->tid) {
-      return s1->kaddr < s2->kaddr;
-  }
-  return s1->tid < s2->tid;
+  size_t slot = page->swap_slot;
+  size_t start, end, lo, hi, i;
+
+  lock_acquire (&cache_lock);
+  if (slot >= cache_base && slot < cache_base + SWAP_CLUSTER
+      && cache_valid[slot - cache_base])
+    {
+      memcpy (kaddr, cache_buf + (slot - cache_base) * PGSIZE, PGSIZE);
+      cache_valid[slot - cache_base] = false;
+      lock_acquire (&swap_lock);
+      hit_cnt++;
+      in_cnt++;
+      lock_release (&swap_lock);
+      lock_release (&cache_lock);
+      return;
+    }
+
+  // Find the run of slots owned by page's address space around slot,
+  // without leaving slot's cluster
+  lock_acquire (&swap_lock);
+  start = slot - slot % SWAP_CLUSTER;
+  end = start + SWAP_CLUSTER;
+  if (end > bitmap_size (slot_bm))
+    end = bitmap_size (slot_bm);
+  for (lo = slot; lo > start && slot_owner[lo - 1] == page->pd; lo--)
+    continue;
+  for (hi = slot + 1; hi < end && slot_owner[hi] == page->pd; hi++)
+    continue;
+  in_cnt++;
+  lock_release (&swap_lock);
+
+  if (hi - lo == 1)
+    {
+      // Nothing to read ahead: straight into the frame
+      block_read_multi (swap_block, slot * SECTORS_IN_PAGE, kaddr,
+                        SECTORS_IN_PAGE);
+      lock_release (&cache_lock);
+      return;
+    }
+
+  // Replace the cache with the whole run, read in one request
+  for (i = 0; i < SWAP_CLUSTER; i++)
+    if (cache_valid[i])
+      {
+        cache_valid[i] = false;
+        waste_cnt++;
+      }
+  block_read_multi (swap_block, lo * SECTORS_IN_PAGE, cache_buf,
+                    (hi - lo) * SECTORS_IN_PAGE);
+  cache_base = lo;
+  for (i = 0; i < hi - lo; i++)
+    cache_valid[i] = lo + i != slot;
+  ahead_cnt += hi - lo - 1;
+  memcpy (kaddr, cache_buf + (slot - lo) * PGSIZE, PGSIZE);
+  lock_release (&cache_lock);
 }
 
-/* Returns the hash_elem corresponding to the given virtual user address */
-static struct hash_elem *
-swap_lookup (void *kaddr, tid_t tid)
+/* Forgets any copy of slot in the swap cache. Caller must hold
+   cache_lock */
+static void
+cache_drop (size_t slot)
 {
-  //Caller needs to hold frame_lock already
-  struct swap s;
-  s.kaddr = kaddr;
-  s.tid = tid;
-  return hash_find (&swap_table, &s.swaphashelem);
+  if (slot >= cache_base && slot < cache_base + SWAP_CLUSTER
+      && cache_valid[slot - cache_base])
+    {
+      cache_valid[slot - cache_base] = false;
+      waste_cnt++;
+    }
 }
 
-void print_swap_table(void) {
-  printf("====SWAP_TABLE====");
-  struct hash_iterator i;
-  hash_first (&i, &swap_table);
-  while (hash_next (&i))
+/* Allocates a free swap slot for page.  The slot at page's
+   position in the cluster of its virtual window is used if that
+   cluster is open and the slot is free; otherwise a new cluster
+   is started at the next free run of SWAP_CLUSTER slots, searching
+   forward from the last allocation.  Falls back to any free slot
+   when no run is left, and panics if the swap partition is full */
+static size_t
+swap_alloc_slot (struct page *page)
+{
+  uintptr_t vpn = pg_no (page->uaddr);
+  uintptr_t vbase = vpn - vpn % SWAP_CLUSTER;
+  size_t idx = vpn % SWAP_CLUSTER;
+  size_t slot = BITMAP_ERROR;
+  size_t i;
+
+  lock_acquire (&swap_lock);
+  for (i = 0; i < OPEN_CLUSTERS; i++)
     {
-      struct swap *s = hash_entry (hash_cur (&i), struct swap, swaphashelem);
-      printf("%d: TID: %d - KADDR: %d", s->sector, s->tid, (int)s->kaddr);
+      struct cluster *c = &clusters[i];
+      if (c->pd == page->pd && c->vbase == vbase)
+        {
+          if (c->base + idx < bitmap_size (slot_bm)
+              && !bitmap_test (slot_bm, c->base + idx))
+            slot = c->base + idx;
+          break;
+        }
     }
+
+  if (slot == BITMAP_ERROR)
+    {
+      size_t base = bitmap_scan (slot_bm, slot_cursor, SWAP_CLUSTER, false);
+      if (base == BITMAP_ERROR && slot_cursor != 0)
+        base = bitmap_scan (slot_bm, 0, SWAP_CLUSTER, false);
+      if (base != BITMAP_ERROR)
+        {
+          struct cluster *c = &clusters[cluster_next];
+          cluster_next = (cluster_next + 1) % OPEN_CLUSTERS;
+          c->pd = page->pd;
+          c->vbase = vbase;
+          c->base = base;
+          slot = base + idx;
+          slot_cursor = base + SWAP_CLUSTER;
+        }
+    }
+
+  if (slot == BITMAP_ERROR)
+    {
+      // Swap is too fragmented for a new cluster: take any slot
+      slot = bitmap_scan (slot_bm, slot_cursor, 1, false);
+      if (slot == BITMAP_ERROR && slot_cursor != 0)
+        slot = bitmap_scan (slot_bm, 0, 1, false);
+      if (slot == BITMAP_ERROR)
+        PANIC("ERROR: Swap partition full!");
+      slot_cursor = slot + 1;
+    }
+
+  if (slot_cursor >= bitmap_size (slot_bm))
+    slot_cursor = 0;
+  bitmap_mark (slot_bm, slot);
+  slot_owner[slot] = page->pd;
+  slot_refs[slot] = 1;
+  lock_release (&swap_lock);
+  return slot;
 }
@@ -1,16 +1,15 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
-#include <stdint.h>
 #include <stdbool.h>
 #include "vm/page.h"
 
 void swap_init (void);
 bool swap_out(struct page *);
+void swap_out_shared(struct page *, const struct page *copy);
 bool swap_in(struct page *);
-int64_t swap_free(struct page *);
-
-// Debug helper
-void print_swap_table(void);
+void swap_free(struct page *);
+void swap_spill(struct page *, const void *data);
+void swap_print_stats (void);
 
 #endif /* vm_swap_h_*/
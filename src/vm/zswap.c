@@ -0,0 +1,399 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+
+/* Compressed swap tier.  Pages being swapped out are compressed
+   with a small LZ77 coder (an LZ4-style byte format) and kept in
+   an arena of kernel pages, up to zswap_limit of them.  When the
+   arena is full the least recently stored pages are written back
+   to the swap partition to make room.  Pages that do not compress
+   to ZSWAP_MAX_LEN bytes go straight to the swap partition.
+
+   Each arena page is split into 64 chunks of ZSWAP_CHUNK bytes and
+   a compressed page occupies a run of chunks within one arena
+   page.  PAGE_ZSWAP in a page's flags says its swapped copy is
+   here rather than in its swap slot; it only changes under
+   zswap_lock */
+#define ZSWAP_CHUNK (PGSIZE / 64)
+#define ZSWAP_MAX_LEN (PGSIZE / 4 * 3) // bigger pages are rejected
+size_t zswap_limit = 64; // Arena size in pages, 0 disables the tier
+
+/* An arena page */
+struct arena
+  {
+    uint8_t *kaddr; // NULL until first needed
+    uint64_t used; // bit i set if chunk i is in use
+  };
+
+/* A page held in the tier */
+struct zswap_entry
+  {
+    struct list_elem lruelem;
+    struct page *page;
+    size_t arena; // index into arenas
+    uint8_t chunk; // first chunk
+    uint8_t chunk_cnt;
+    uint16_t len; // compressed length in bytes
+  };
+
+static struct arena *arenas;
+static size_t arena_cnt; // arenas with a kernel page
+static struct list lru; // least recently stored at the front
+static struct lock zswap_lock;
+
+/* Scratch space, used under zswap_lock */
+#define HASH_BITS 12
+static uint16_t lz_table[1 << HASH_BITS];
+static uint8_t lz_buf[ZSWAP_MAX_LEN];
+static uint8_t *spill_buf; // one page for writeback
+
+/* Statistics */
+static long long store_cnt; // pages stored
+static long long reject_cnt; // pages that did not compress well enough
+static long long bytes_in; // uncompressed bytes stored
+static long long bytes_out; // compressed bytes stored
+static long long lookup_cnt; // swap-ins looked up here
+static long long hit_cnt; // swap-ins served from here
+static long long writeback_cnt; // pages spilled to the swap partition
+
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t cap);
+static bool lz_decompress (const uint8_t *src, size_t len, uint8_t *dst);
+static bool zswap_alloc (size_t len, size_t *arena, uint8_t *chunk);
+static void zswap_free_entry (struct zswap_entry *e);
+static bool zswap_writeback (void);
+
+/* Initialises the global static variables */
+void
+zswap_init (void)
+{
+  lock_init (&zswap_lock);
+  list_init (&lru);
+  if (zswap_limit == 0)
+    return;
+  arenas = calloc (zswap_limit, sizeof *arenas);
+  spill_buf = palloc_get_page (0);
+  if (arenas == NULL || spill_buf == NULL)
+    {
+      printf ("zswap: out of memory, tier disabled\n");
+      free (arenas);
+      palloc_free_page (spill_buf);
+      zswap_limit = 0;
+    }
+}
+
+/* Compresses page's frame into the tier, writing back older pages
+   if there is no room.  Sets PAGE_ZSWAP and returns true on
+   success, or returns false if the page must go to the swap
+   partition instead */
+bool
+zswap_store (struct page *page)
+{
+  struct zswap_entry *e;
+  size_t len;
+
+  if (zswap_limit == 0)
+    return false;
+  e = malloc (sizeof *e);
+  if (e == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  len = lz_compress (page->kaddr, lz_buf, sizeof lz_buf);
+  if (len == 0)
+    {
+      reject_cnt++;
+      goto fail;
+    }
+  while (!zswap_alloc (len, &e->arena, &e->chunk))
+    if (!zswap_writeback ())
+      goto fail;
+
+  e->page = page;
+  e->len = len;
+  e->chunk_cnt = DIV_ROUND_UP (len, ZSWAP_CHUNK);
+  memcpy (arenas[e->arena].kaddr + e->chunk * ZSWAP_CHUNK, lz_buf, len);
+  list_push_back (&lru, &e->lruelem);
+  page->zswap = e;
+  page->flags |= PAGE_ZSWAP;
+  store_cnt++;
+  bytes_in += PGSIZE;
+  bytes_out += len;
+  lock_release (&zswap_lock);
+  return true;
+
+ fail:
+  lock_release (&zswap_lock);
+  free (e);
+  return false;
+}
+
+/* If page's swapped copy is in the tier, decompresses it into the
+   frame at kaddr, releases it, clears PAGE_ZSWAP and returns
+   true.  Otherwise returns false */
+bool
+zswap_load (struct page *page, void *kaddr)
+{
+  bool hit;
+
+  lock_acquire (&zswap_lock);
+  lookup_cnt++;
+  hit = page->flags & PAGE_ZSWAP;
+  if (hit)
+    {
+      struct zswap_entry *e = page->zswap;
+      if (!lz_decompress (arenas[e->arena].kaddr + e->chunk * ZSWAP_CHUNK,
+                          e->len, kaddr))
+        PANIC ("zswap: corrupt compressed page");
+      zswap_free_entry (e);
+      hit_cnt++;
+    }
+  lock_release (&zswap_lock);
+  return hit;
+}
+
+/* If page's swapped copy is in the tier, discards it, clears
+   PAGE_ZSWAP and returns true.  Otherwise returns false */
+bool
+zswap_drop (struct page *page)
+{
+  bool held;
+
+  lock_acquire (&zswap_lock);
+  held = page->flags & PAGE_ZSWAP;
+  if (held)
+    zswap_free_entry (page->zswap);
+  lock_release (&zswap_lock);
+  return held;
+}
+
+/* Prints statistics for the tier */
+void
+zswap_print_stats (void)
+{
+  long long ratio = bytes_out > 0 ? bytes_in * 100 / bytes_out : 0;
+  long long hit_pct = lookup_cnt > 0 ? hit_cnt * 100 / lookup_cnt : 0;
+
+  if (zswap_limit == 0)
+    return;
+  printf ("Zswap: %lld pages stored, %lld rejected, "
+          "compression ratio %lld.%02lld, %zu of %zu arena pages\n",
+          store_cnt, reject_cnt, ratio / 100, ratio % 100,
+          arena_cnt, zswap_limit);
+  printf ("Zswap: %lld of %lld swap-ins hit (%lld%%), "
+          "%lld pages written back\n",
+          hit_cnt, lookup_cnt, hit_pct, writeback_cnt);
+}
+
+/* Releases entry e and its chunks and clears PAGE_ZSWAP on its
+   page. Caller must hold zswap_lock */
+static void
+zswap_free_entry (struct zswap_entry *e)
+{
+  uint64_t run = e->chunk_cnt < 64 ? (1ULL << e->chunk_cnt) - 1 : ~0ULL;
+
+  arenas[e->arena].used &= ~(run << e->chunk);
+  list_remove (&e->lruelem);
+  e->page->flags &= ~PAGE_ZSWAP;
+  e->page->zswap = NULL;
+  free (e);
+}
+
+/* Writes the least recently stored page back to the swap
+   partition and releases its space. Returns false if the tier is
+   empty. Caller must hold zswap_lock, which also keeps the page's
+   owner from swapping it in until its slot is recorded */
+static bool
+zswap_writeback (void)
+{
+  struct zswap_entry *e;
+
+  if (list_empty (&lru))
+    return false;
+  e = list_entry (list_front (&lru), struct zswap_entry, lruelem);
+  if (!lz_decompress (arenas[e->arena].kaddr + e->chunk * ZSWAP_CHUNK,
+                      e->len, spill_buf))
+    PANIC ("zswap: corrupt compressed page");
+  swap_spill (e->page, spill_buf);
+  zswap_free_entry (e);
+  writeback_cnt++;
+  return true;
+}
+
+/* Finds a run of chunks for len bytes, first fit, adding an arena
+   page if all present ones are too full and the limit allows.
+   Caller must hold zswap_lock */
+static bool
+zswap_alloc (size_t len, size_t *arena, uint8_t *chunk)
+{
+  size_t cnt = DIV_ROUND_UP (len, ZSWAP_CHUNK);
+  uint64_t run = cnt < 64 ? (1ULL << cnt) - 1 : ~0ULL;
+  size_t i, start;
+
+  for (i = 0; i < zswap_limit; i++)
+    {
+      struct arena *a = &arenas[i];
+      if (a->kaddr == NULL)
+        {
+          a->kaddr = palloc_get_page (0);
+          if (a->kaddr == NULL)
+            return false;
+          a->used = 0;
+          arena_cnt++;
+        }
+      for (start = 0; start + cnt <= 64; start++)
+        if ((a->used & (run << start)) == 0)
+          {
+            a->used |= run << start;
+            *arena = i;
+            *chunk = start;
+            return true;
+          }
+    }
+  return false;
+}
+
+/* Reads a 32-bit word from p, which need not be aligned */
+static inline uint32_t
+lz_read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/* Writes a length of n, less the 15 already in a token, as a run
+   of 255s and a final byte */
+static uint8_t *
+lz_put_length (uint8_t *op, size_t n)
+{
+  for (; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = n;
+  return op;
+}
+
+/* Compresses the PGSIZE bytes at src into dst, which has room for
+   cap bytes. Returns the compressed length, or 0 if it would not
+   fit. Each sequence is a token byte holding the literal count in
+   its high nibble and the match length less 4 in its low one
+   (15 meaning more follows), then the literals, then a 2-byte
+   match offset.  The last sequence has literals only */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t cap)
+{
+  const uint8_t *ip = src, *anchor = src, *end = src + PGSIZE;
+  uint8_t *op = dst, *oend = dst + cap;
+  size_t lits;
+
+  memset (lz_table, 0, sizeof lz_table);
+  while (ip + 4 <= end)
+    {
+      uint32_t seq = lz_read32 (ip);
+      uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+      const uint8_t *m = src + lz_table[h] - 1;
+      size_t mlen;
+      uint8_t *token;
+
+      bool found = lz_table[h] != 0 && lz_read32 (m) == seq;
+      lz_table[h] = ip - src + 1;
+      if (!found)
+        {
+          ip++;
+          continue;
+        }
+      for (mlen = 4; ip + mlen < end && ip[mlen] == m[mlen]; mlen++)
+        continue;
+
+      lits = ip - anchor;
+      if (op + 1 + lits / 255 + 1 + lits + 2 + (mlen - 4) / 255 + 1 > oend)
+        return 0;
+      token = op++;
+      *token = (lits < 15 ? lits : 15) << 4;
+      if (lits >= 15)
+        op = lz_put_length (op, lits - 15);
+      memcpy (op, anchor, lits);
+      op += lits;
+      *op++ = (ip - m) & 0xff;
+      *op++ = (ip - m) >> 8;
+      *token |= mlen - 4 < 15 ? mlen - 4 : 15;
+      if (mlen - 4 >= 15)
+        op = lz_put_length (op, mlen - 4 - 15);
+      ip += mlen;
+      anchor = ip;
+    }
+
+  lits = end - anchor;
+  if (op + 1 + lits / 255 + 1 + lits > oend)
+    return 0;
+  *op++ = (lits < 15 ? lits : 15) << 4;
+  if (lits >= 15)
+    op = lz_put_length (op, lits - 15);
+  memcpy (op, anchor, lits);
+  op += lits;
+  return op - dst;
+}
+
+/* Decompresses len bytes at src, as written by lz_compress, into
+   the PGSIZE bytes at dst. Returns false if the input is
+   malformed */
+static bool
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst)
+{
+  const uint8_t *ip = src, *iend = src + len;
+  uint8_t *op = dst, *oend = dst + PGSIZE;
+
+  while (ip < iend)
+    {
+      uint8_t token = *ip++;
+      size_t lits = token >> 4, mlen = token & 15, ofs;
+      uint8_t b;
+
+      if (lits == 15)
+        do
+          {
+            if (ip >= iend)
+              return false;
+            b = *ip++;
+            lits += b;
+          }
+        while (b == 255);
+      if (lits > (size_t) (iend - ip) || lits > (size_t) (oend - op))
+        return false;
+      memcpy (op, ip, lits);
+      op += lits;
+      ip += lits;
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return false;
+      ofs = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (mlen == 15)
+        do
+          {
+            if (ip >= iend)
+              return false;
+            b = *ip++;
+            mlen += b;
+          }
+        while (b == 255);
+      mlen += 4;
+      if (ofs == 0 || ofs > (size_t) (op - dst)
+          || mlen > (size_t) (oend - op))
+        return false;
+      // Byte by byte, since the match may overlap its own output
+      for (; mlen > 0; mlen--, op++)
+        *op = op[-ofs];
+    }
+  return op == oend;
+}
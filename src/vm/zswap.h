@@ -0,0 +1,18 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "vm/page.h"
+
+/* Compressed swap tier, kept in kernel memory in front of the
+   swap partition */
+extern size_t zswap_limit;
+
+void zswap_init (void);
+bool zswap_store (struct page *);
+bool zswap_load (struct page *, void *kaddr);
+bool zswap_drop (struct page *);
+void zswap_print_stats (void);
+
+#endif /* vm_zswap_h */